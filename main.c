@@ -1,6 +1,16 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#endif
 
 
 typedef enum {
@@ -8,11 +18,22 @@ typedef enum {
     OBJ_PAIR
 } ObjectType;
 
-typedef struct sObject {
-    ObjectType type;
-    unsigned char marked;
-    struct sObject* next; // The internal link for the "Sweep" phase
+#define NUM_OBJECT_TYPES 2
+
+/**
+ * Integers point at nothing, so they're "leaf" objects. Pairs carry
+ * pointers. The two never share a page (see the Space notes below).
+ */
+static inline int isLeafType(ObjectType type) {
+    return type == OBJ_INT;
+}
 
+/*
+ * An object is just its payload: a pair is exactly two pointers. Its type
+ * isn't stored in it - every page only holds one type of object, so the type
+ * lives in the page header (see objectType()).
+ */
+typedef struct sObject {
     union {
         int value; // For Integers
         struct {   // For Pairs
@@ -22,21 +43,610 @@ typedef struct sObject {
     };
 } Object;
 
+/*
+ * Immediate integers. Objects are always at least 8-byte aligned, so a real
+ * Object* never has its low bit set. With immediateInts on, pushInt() doesn't
+ * allocate at all: it shifts the integer left and sets the low bit, and that
+ * tagged word goes on the stack (or into a pair) in place of a pointer. The
+ * marker sees the tag and skips it, just like NULL. Use isInt() / intValue()
+ * to read one without caring which way it was made.
+ */
+#define INT_TAG 1
+
+static inline int isImmediate(const Object* object) {
+    return ((uintptr_t)object & INT_TAG) != 0;
+}
+
+static inline Object* makeImmediate(int value) {
+    return (Object*)(((uintptr_t)(intptr_t)value << 1) | INT_TAG);
+}
+
+/**
+ * True if this is something the GC has to look at: not NULL, and not an
+ * immediate integer.
+ */
+static inline int isHeapObject(const Object* object) {
+    return object != NULL && !isImmediate(object);
+}
+
 #define STACK_MAX 256
 #define INITIAL_GC_THRESHOLD 8
 
+/*
+ * Heap pages. Instead of asking malloc for every single object, we grab
+ * PAGE_SIZE chunks (aligned to PAGE_SIZE, so any object can find its page by
+ * masking its address) and carve them into Object-sized slots. A fresh page
+ * is handed out by bumping a pointer; slots that come back from the sweeper
+ * are threaded onto a per-page free list, so freeing is just a push. The
+ * pages themselves are the "list of every object": the sweeper walks each
+ * page's slots front to back instead of chasing per-object links.
+ *
+ * Each page holds objects of a single type, recorded in its header, so
+ * objects don't need a type field and a pair is just two words. An empty
+ * page can be reused for either type.
+ *
+ * The pages of each type make up a space: the leaf space (integers, no
+ * outgoing pointers) and the pointer space (pairs). The marker never looks
+ * inside a leaf page. The sweeper never writes to a leaf page's slots
+ * either: dead leaf slots aren't threaded onto a free list, the allocator
+ * finds them straight from the mark bitmap ("holes") and flips each one's
+ * bit to the current sense as it hands it out, so the bit keeps saying
+ * "in use" until the next cycle starts. Pointer pages keep their free lists.
+ *
+ * Mark bits don't live in the objects either. Each page has a side bitmap
+ * with one bit per slot, so marking never dirties an object's cache line and
+ * clearing marks for a new cycle is a memset over a few hundred bytes. The
+ * bitmap is padded to a whole number of 256-bit vectors so the sweeper can
+ * count it with SIMD loads (the padding bits are always 0).
+ *
+ * With markEpochFlip on we don't even do the memset. What a bit *means*
+ * flips every cycle: a slot is marked when its bit equals markSense, and
+ * markSense alternates. The sweeper leaves every bit it looks at equal to the
+ * current sense - survivors already are, so only words with dead or unused
+ * slots get written - and at the next cycle the flip turns all of those into
+ * "unmarked" in one go. A page that was marked but never swept (lazy
+ * sweeping, or a benchmark that only marks) is caught by its sweptEpoch and
+ * reset at the start of the next cycle.
+ */
+#define PAGE_SIZE (32 * 1024)
+#define MAX_SLOTS_PER_PAGE (PAGE_SIZE / sizeof(Object))
+#define MARK_WORDS ((MAX_SLOTS_PER_PAGE + 255) / 256 * 4)
+
+typedef struct sFreeSlot {
+    struct sFreeSlot* next;
+} FreeSlot;
+
+typedef struct sPage {
+    struct sPage* nextAvail; // Next page on the "has room" or empty list
+    ObjectType type;         // What kind of object every slot holds
+    int compactIndex;        // Compaction: this page's row in compactRanks
+    int evacuating;          // Immix: move everything out at the next mark
+    FreeSlot* freeList;      // Recycled slots inside this page
+    int bump;                // Index of the first never-used slot
+    int holes;               // Leaf pages: dead slots left below holeLimit
+    int holeLimit;           // Leaf pages: the bump index when last swept
+    int inAvailList;         // On a "has room" list or emptyPages right now
+    unsigned sweptEpoch;     // markEpoch when the bitmap was last normalized
+    int inNursery;           // On nurseryPages right now
+    int inDirtyList;         // On dirtyPages right now
+    int youngObjects;        // Young survivors left by the last sweep
+    uint64_t cards;          // One dirty bit per CARD_SIZE bytes of the page
+    struct sTreadmillLink* links; // Treadmill: this page's link page
+    _Alignas(32) uint64_t markBits[MARK_WORDS]; // One mark bit per slot
+    uint64_t oldBits[MARK_WORDS];    // Which slots hold old objects
+    uint64_t ageBits[2][MARK_WORDS]; // Minor GCs survived, 2 bits per slot
+} Page;
+
+/*
+ * Thread-local allocation buffer (TLAB). Each mutator thread owns one page
+ * per object type at a time: it bumps through the page's never-used slots,
+ * then pops its recycled slots (or, in a leaf page, its holes), and only
+ * goes back to the shared page lists (under heapLock) when those run dry.
+ */
+typedef struct {
+    Object* cursor;     // Next slot to hand out
+    Object* limit;      // End of the bump region
+    FreeSlot* freeList; // Recycled slots we took from the page
+    int holes;          // Holes we took from the page that are still unused
+    int holeWord;       // Mark word we're currently taking holes from
+    uint64_t holeBits;  // Holes left in that word
+    Page* page;         // The page this buffer is carved from
+} AllocBuffer;
+
+/*
+ * Per-space bookkeeping: which pages have room, and what the sweeper found
+ * out about the space while it was sweeping anyway.
+ */
+typedef struct {
+    const char* name;
+    Page* availPages;  // Pages with some (but not all) slots free
+    long liveObjects;  // Survivors in the pages swept since the last GC
+    long pagesSwept;   // Pages of this space swept since the last GC
+} Space;
+
+/*
+ * Generational collection. Most objects die young, so with generational on
+ * most collections are minor ones that only look at the nursery: the young
+ * objects allocated since the last collection, plus young survivors that
+ * haven't been promoted yet.
+ *
+ * Nothing moves. An object is old when its bit in its page's oldBits is
+ * set, and old objects keep their mark bits set between collections ("sticky"
+ * mark bits). So a minor GC marks from the roots without clearing anything:
+ * old objects already look marked and are never traced, and only young
+ * objects get marked. Every page that has young objects in it is on
+ * nurseryPages, and only those pages get swept. Each young survivor's
+ * 2-bit age goes up; once it reaches promotionAge it becomes old. Full
+ * collections clear everything and mark the whole heap as usual.
+ *
+ * The one thing a minor GC can't see on its own is an old object pointing
+ * at a young one. Those are tracked with a card table: each page has a
+ * 64-bit mask, one bit per CARD_SIZE bytes. setHead()/setTail() dirty the
+ * card of an old pair when they store a young object into it, and promoting
+ * a pair dirties its card too (its children might still be young). A minor
+ * GC treats every old pair in a dirty card as a root, and afterwards cleans
+ * the cards that no longer point at anything young. Pages with dirty cards
+ * are on dirtyPages, so finding them doesn't cost a heap walk either.
+ */
+#define CARD_SHIFT 9
+#define CARD_SIZE (1 << CARD_SHIFT)
+
+#define PAGE_HEADER_SIZE \
+    ((sizeof(Page) + sizeof(Object) - 1) / sizeof(Object) * sizeof(Object))
+#define SLOTS_PER_PAGE ((int)((PAGE_SIZE - PAGE_HEADER_SIZE) / sizeof(Object)))
+
+/*
+ * The mark stack. Marking used to recurse on head and tail, which blew the C
+ * stack on long lists. Now grey objects (marked, children not looked at yet)
+ * wait here instead. It grows on demand; if it can't grow (out of memory, or
+ * we hit markStackLimit) we set 'overflowed', drop the push, and later rescan
+ * the heap for marked objects whose children were never visited.
+ */
+#define MARK_STACK_INITIAL 256
+
+/*
+ * Prefetch-on-grey. With markPrefetch on, every newly marked child gets a
+ * software prefetch and goes on the mark stack; popped objects then sit in a
+ * small FIFO for PREFETCH_FIFO_SIZE steps before we scan them, which gives the
+ * memory system time to bring them into cache.
+ */
+#define PREFETCH_FIFO_SIZE 8
+
+typedef struct {
+    Object** items;
+    int count;
+    int capacity;
+    int overflowed;
+} MarkStack;
+
+/*
+ * Parallel marking. With gcWorkers > 1, marking is split across a pool of GC
+ * worker threads. Each worker owns a Chase-Lev work-stealing deque: it pushes
+ * and takes grey objects at the bottom, and idle workers steal from the top
+ * of everybody else's. Mark bits are set with an atomic fetch-or so two
+ * workers can never both claim the same object.
+ */
+#define DEQUE_INITIAL 1024
+
+typedef struct sDequeArray {
+    long capacity;               // Always a power of two
+    struct sDequeArray* retired; // Arrays we outgrew, freed after marking
+    Object* items[];
+} DequeArray;
+
+typedef struct {
+    _Alignas(64) long top; // Thieves take from here
+    long bottom;           // The owner pushes and takes here
+    DequeArray* array;
+    long marked;           // Objects the owner marked this cycle
+} WorkDeque;
+
+#define MAX_GC_WORKERS 64
+
+typedef void (*GcTask)(int worker);
+
+/*
+ * Parallel sweeping. Workers claim SWEEP_CHUNK pages at a time from a shared
+ * counter and sweep them on their own, collecting the pages that still have
+ * room into a private list. Once everybody is done, the private lists are
+ * just spliced together - there's no lock anywhere in the sweep.
+ */
+#define SWEEP_CHUNK 16
+
+typedef struct {
+    _Alignas(64) Page* availHead[NUM_OBJECT_TYPES]; // Swept pages with room
+    Page* availTail[NUM_OBJECT_TYPES];
+    Page* emptyHead;              // Swept pages where nothing survived
+    Page* emptyTail;
+    long live;                    // Survivors this worker counted
+} SweepResult;
+
+/*
+ * When to sweep. SWEEP_EAGER sweeps the whole heap inside gc(). SWEEP_LAZY
+ * only marks inside gc() and leaves every page unswept; newObject() then
+ * sweeps pages one at a time whenever it needs somewhere to allocate, so the
+ * pause depends on how much is alive rather than on how big the heap is.
+ * SWEEP_CONCURRENT is the same, except a background sweeper thread also
+ * works through the unswept pages and hands them to the allocator, so the
+ * mutator rarely has to sweep anything itself.
+ *
+ * Either way the pages to sweep are a snapshot taken during the pause
+ * (sweepQueue), and whoever wants the next page claims it with an atomic
+ * increment of lazySweepNext, so no page is ever swept twice.
+ */
+typedef enum {
+    SWEEP_EAGER,
+    SWEEP_LAZY,
+    SWEEP_CONCURRENT
+} SweepMode;
+
+/*
+ * Which collector gc() runs. COLLECTOR_MARK_SWEEP is everything above.
+ * COLLECTOR_COPYING is a Cheney-style semispace collector built out of the
+ * same pages: every page that has objects in it is from-space, and the
+ * survivors get copied into empty pages (to-space) breadth-first, with the
+ * to-space pair pages themselves as the queue. Nothing is ever swept, so
+ * the cost of a collection depends only on what's alive, and the mutator
+ * always allocates with a plain pointer bump. Afterwards the from-space
+ * pages are emptied and become the pool the next to-space comes from.
+ *
+ * An object that's been copied has its mark bit set (in from-space), and
+ * its first word overwritten with the address of its copy - the forwarding
+ * pointer. So forwarding needs no extra header either.
+ *
+ * COLLECTOR_IMMIX is mark-region, Immix style. Every page is cut into
+ * LINE_SIZE-byte lines, and a line is in use if anything on it survived.
+ * A line is LINE_SLOTS slots, which is exactly one byte of the mark
+ * bitmap, so marking an object marks its line too at no extra cost. The
+ * sweep builds no free lists: it only counts each page's free lines, and
+ * the allocator bumps through each run of free lines ("hole") in turn.
+ * Pages the sweep finds nearly empty aren't allocated into; instead the
+ * next mark evacuates them, copying each object it reaches there into a
+ * fresh page (leaving a forwarding pointer, like the copying collector)
+ * and fixing the pointer it came through, so the whole page comes back
+ * empty.
+ *
+ * COLLECTOR_TREADMILL is Baker's treadmill: incremental, non-moving, and
+ * with no sweep at all. Every slot of every page is a cell on a circular
+ * doubly linked list, one list per space, cut into four segments by four
+ * sentinel nodes:
+ *
+ *   blackS -> black... -> greyS -> grey... -> whiteS -> white...
+ *          -> freeS -> free... -> (back to blackS)
+ *
+ * Allocating takes the first free cell (the most recently freed, since a
+ * flip puts the new garbage at the front) and makes it the first black
+ * one. Shading a white object moves it to the end of the grey segment (a
+ * leaf goes straight to black - it has nothing to scan), and
+ * scanning the first grey cell moves it to the end of the black segment.
+ * Each of those is one unlink and one insert. Every allocation scans
+ * markWorkRatio grey cells first. Once nothing is grey and the free cells
+ * run out, we flip: the white segment is garbage, so it simply becomes
+ * free, black becomes white, and the roots are shaded to start the next
+ * cycle. The flip only renames and relinks the sentinels, and flipping
+ * markSense turns every black mark bit white at once, so no cell is ever
+ * visited to free it. If the free cells run out before the mark is done,
+ * the space gets a new page instead.
+ *
+ * Objects have no room for links, so each page gets a link page: a second
+ * PAGE_SIZE block whose first word points back at the page, and whose
+ * slot i holds the links of the page's slot i. An object and its links
+ * are at the same offset in their blocks, so each finds the other with a
+ * mask and an add. That's Baker's two extra words per object.
+ */
+typedef enum {
+    COLLECTOR_MARK_SWEEP,
+    COLLECTOR_COPYING,
+    COLLECTOR_IMMIX,
+    COLLECTOR_TREADMILL
+} Collector;
+
+typedef struct sTreadmillLink {
+    struct sTreadmillLink* prev;
+    struct sTreadmillLink* next;
+} TreadmillLink;
+
+typedef struct {
+    TreadmillLink sentinels[4];
+    TreadmillLink* blackS; // Black cells follow this one, then greyS
+    TreadmillLink* greyS;  // Grey cells follow this one, then whiteS
+    TreadmillLink* whiteS; // White cells follow this one, then freeS
+    TreadmillLink* freeS;  // Free cells follow this one, then blackS
+    int black;
+    int grey;
+    int white;
+    int free;
+} Treadmill;
+
+/*
+ * How big the heap gets to be before the next collection. After every full
+ * collection resizeHeap() asks the growth policy for a new maxObjects,
+ * given how many objects survived (the live set):
+ *
+ * GROWTH_FACTOR multiplies the live set by growthFactor. 2 is the classic
+ * "double what's left".
+ *
+ * GROWTH_GOGC lets the heap grow by gogcPercent percent of the live set
+ * before collecting again, like Go's GOGC. 100 is the same as a factor of
+ * 2; 50 collects more often in less memory, 400 the other way round.
+ *
+ * GROWTH_LIVE_RATIO sizes the heap so the live set fills targetLiveRatio
+ * of it. While the live set stays within LIVE_RATIO_SLACK of that ratio
+ * the limit is left alone, so a live set that wobbles a little doesn't
+ * resize the heap after every collection.
+ *
+ * GROWTH_MAX_HEAP grows by growthFactor like GROWTH_FACTOR, but never past
+ * maxHeapObjects. If the live set alone doesn't fit under the cap, we're
+ * out of memory.
+ *
+ * Whatever the policy says, the limit is never below minHeapObjects, so a
+ * tiny (or empty) live set doesn't mean collecting every few allocations.
+ * With heapLog on, every decision gets printed. Generational collection
+ * doesn't use a policy: the next collection is always a nursery away.
+ */
+typedef enum {
+    GROWTH_FACTOR,
+    GROWTH_GOGC,
+    GROWTH_LIVE_RATIO,
+    GROWTH_MAX_HEAP
+} GrowthPolicy;
+
+#define LIVE_RATIO_SLACK 0.1
+
+#define LINE_SIZE 128
+#define LINE_SLOTS ((int)(LINE_SIZE / sizeof(Object)))
+#define LINES_PER_PAGE ((SLOTS_PER_PAGE + LINE_SLOTS - 1) / LINE_SLOTS)
+
+/*
+ * Write barriers. setHead()/setTail() run one before every pointer store, and
+ * which ones get compiled in is picked with -DWRITE_BARRIER=... (OR them
+ * together). A barrier that isn't compiled in costs nothing at all - not even
+ * a flag check.
+ *
+ *   BARRIER_CARD     - dirties a card when an old pair gets a young child,
+ *                      so a minor GC can find it (needed for --gen)
+ *   BARRIER_SATB     - snapshot-at-the-beginning: while marking is running,
+ *                      logs the pointer being overwritten so it still gets
+ *                      marked
+ *   BARRIER_DIJKSTRA - insertion: while marking is running, shades the
+ *                      pointer being stored
+ *
+ * BARRIER_NONE is for a plain stop-the-world collector that never needs one.
+ */
+#define BARRIER_NONE 0
+#define BARRIER_CARD 1
+#define BARRIER_SATB 2
+#define BARRIER_DIJKSTRA 4
+
+#ifndef WRITE_BARRIER
+#define WRITE_BARRIER (BARRIER_CARD | BARRIER_SATB)
+#endif
+
+#define SATB_LOG_INITIAL 256
+
+/*
+ * Incremental marking. With incrementalMark on, reaching maxObjects doesn't
+ * stop the world for a whole mark. It only greys the roots and turns the
+ * write barriers on (markingActive). From then on every newObject() pays for
+ * itself with markWorkRatio objects' worth of marking (every object is the
+ * same 16 bytes, so that's proportional to the bytes allocated), done in
+ * steps of at least MARK_STEP_WORK and cut short once a step has taken
+ * markStepMicros. Objects allocated while marking are born black.
+ *
+ * When nothing grey is left (or the heap has doubled since marking started,
+ * so the mutator is clearly winning) one short pause finishes the job: the
+ * roots are looked at again, the SATB log is drained, and the heap is swept
+ * as usual - or not at all, with lazy or concurrent sweeping.
+ *
+ * The barriers are what keep this correct: SATB keeps everything that was
+ * reachable at the start, and Dijkstra shades whatever gets stored into an
+ * object the marker has already finished with. One of them has to be
+ * compiled in.
+ */
+#define MARK_STEP_WORK 64
+
+/*
+ * Concurrent marking. With concurrentMark on, an incremental mark is done
+ * by a background thread (the marker) instead of by newObject(). The pause
+ * at the start only greys the stack; then the marker owns the mark stack
+ * and marks with atomic bit flips, since the mutator is flipping bits too
+ * (new objects are still born black). The mutator keeps logging into its
+ * own SATB log, and every SATB_FLUSH entries it hands the log over to the
+ * marker through markerQueue. The Dijkstra barrier logs instead of shading,
+ * since it can't touch the marker's stack. Once the marker runs out of work
+ * the next allocation notices and finishes the cycle in a short pause:
+ * the marker parks, and the stack and whatever is left in the logs get
+ * marked the usual way.
+ */
+#define SATB_FLUSH 256
+
+/*
+ * Time-based scheduling, Metronome style. With timeScheduled on, an
+ * incremental mark isn't paid for by allocation but by the clock. Time is
+ * cut into beats of gcQuantumMicros, and the collector may take a whole
+ * beat (a quantum) as long as no gcWindowMicros-long run of beats ends up
+ * with more than (1 - targetMmu) of it collecting. So the mutator always
+ * gets at least targetMmu of every window - its minimum mutator
+ * utilization (MMU) - however fast it allocates. gcBeats remembers the
+ * last few beats the collector took, which is all that check needs.
+ *
+ * Allocation only looks at the clock every BEAT_CHECK_ALLOCS objects, so a
+ * quantum can start a little late, and it checks the clock every 32 units
+ * of marking, so it can run a little past its beat. The short pause that
+ * starts a cycle goes straight into a quantum if the window has room for
+ * one. What the grid can't help with is the mutator filling the heap
+ * before marking is done: then the rest of the mark happens in one pause,
+ * as always (markOverruns counts those). More heap, or a lower targetMmu,
+ * is the way out of that.
+ */
+#define BEAT_CHECK_ALLOCS 16
+
+typedef struct {
+    double start; // Seconds, from nowSeconds()
+    double end;
+} GcInterval;
+
 /* Global VM State */
 Object* stack[STACK_MAX];
 int stackSize = 0;
 
-Object* firstObject = NULL; // Head of the linked list of all objects
 int numObjects = 0;
 int maxObjects = INITIAL_GC_THRESHOLD;
 
+GrowthPolicy growthPolicy = GROWTH_FACTOR;
+double growthFactor = 2;      // GROWTH_FACTOR and GROWTH_MAX_HEAP
+int gogcPercent = 100;        // GROWTH_GOGC
+double targetLiveRatio = 0.5; // GROWTH_LIVE_RATIO
+int maxHeapObjects = 1 << 20; // GROWTH_MAX_HEAP
+int minHeapObjects = INITIAL_GC_THRESHOLD; // The smallest limit we ever set
+int heapLog = 0;              // Print a line for each growth decision
+
+Page** pages = NULL;     // Every page in the heap
+int numPages = 0;
+int pageCapacity = 0;
+Space spaces[NUM_OBJECT_TYPES] = {{"leaf", NULL, 0, 0},     // OBJ_INT
+                                  {"pointer", NULL, 0, 0}}; // OBJ_PAIR
+Page* emptyPages = NULL; // The page pool: pages with nothing alive in them
+long pagesReleased = 0;  // Pages the sweeper found completely dead
+pthread_mutex_t heapLock = PTHREAD_MUTEX_INITIALIZER;
+
+_Thread_local AllocBuffer tlabs[NUM_OBJECT_TYPES];
+
+MarkStack markStack = {NULL, 0, 0, 0};
+int markStackLimit = 0; // Max entries before we overflow (0 = no limit)
+int markRescans = 0;    // How many times overflow made us rescan the heap
+int markPrefetch = 1;   // Use the prefetching mark loop
+long markedObjects = 0; // Objects marked so far this cycle
+int markEpochFlip = 1;  // Flip the mark sense instead of clearing bitmaps
+int markSense = 1;      // The bit value that means "marked" this cycle
+unsigned markEpoch = 0; // Counts GC cycles (for spotting unswept pages)
+long bitmapBytesWritten = 0; // Mark bitmap bytes cleared or reset so far
+int immediateInts = 0;  // pushInt() makes tagged immediates, not heap objects
+
+int generational = 0;    // Collect the nursery between full collections
+int nurserySize = 4096;  // Allocations between minor collections
+int promotionAge = 2;    // Minor collections survived before promotion (1-3)
+Page** nurseryPages = NULL; // Pages with young objects in them
+int numNurseryPages = 0;
+int nurseryCapacity = 0;
+Page** dirtyPages = NULL;   // Pages with at least one dirty card
+int numDirtyPages = 0;
+int dirtyCapacity = 0;
+int youngObjects = 0;       // Young objects right after the last collection
+int lastGcObjects = 0;      // numObjects right after the last collection
+int fullGcThreshold = 4096; // Old objects that force a full GC
+long youngSurvived = 0;     // Young survivors found by the current sweep
+long promotedObjects = 0;   // Objects promoted so far
+long minorCollections = 0;
+long fullCollections = 0;
+double lastGcPause = 0;     // How long the last collection took (seconds)
+int gcLog = 1;              // Print a line for each GC that freed something
+
+int markingActive = 0;      // Marking is in progress while the mutator runs
+Object** satbLog = NULL;    // Overwritten pointers the marker still has to see
+int satbCount = 0;
+int satbCapacity = 0;
+int incrementalMark = 0;    // Mark a bit at a time from newObject()
+int markWorkRatio = 4;      // Objects scanned per allocation while marking
+int markStepMicros = 100;   // Longest a single mark step may run (0 = no limit)
+int markCredit = 0;         // Marking work allocation has paid for so far
+int markDeadline = 0;       // numObjects at which we stop marking bit by bit
+int markDeferred = 0;       // A mark is due, waiting on the lazy sweep
+long markSteps = 0;         // Incremental mark steps taken so far
+double longestMarkStep = 0; // The longest one (seconds)
+int timeScheduled = 0;      // Pace incremental marking by the clock instead
+int gcQuantumMicros = 500;  // How long one beat (and so one quantum) is
+int gcWindowMicros = 10000; // The window the MMU is guaranteed over
+double targetMmu = 0.7;     // Share of every window the mutator always gets
+long* gcBeats = NULL;       // The last few beats the collector took
+int gcBeatCount = 0;        // How many of those a window may hold
+int gcBeatNext = 0;         // Where the next one goes (the oldest)
+long markOverruns = 0;      // Marks the heap outgrew, finished in one pause
+int recordGcTimes = 0;      // Keep gcTimes for minimumMutatorUtilization()
+GcInterval* gcTimes = NULL; // When the collector ran, in order
+int numGcTimes = 0;
+int gcTimesCapacity = 0;
+int concurrentMark = 0;     // Let the marker thread do the incremental marking
+long concurrentMarked = 0;  // Objects the marker thread has marked so far
+Object** markerQueue = NULL; // SATB entries handed over to the marker
+int markerQueueCount = 0;
+int markerQueueCapacity = 0;
+Object** markerTaken = NULL; // The entries the marker is working through
+int markerTakenCapacity = 0;
+long markerMarked = 0;      // Objects the marker marked this cycle
+
+pthread_t markerThread;
+int markerStarted = 0;
+int markerBusy = 0;         // The marker is working on a cycle
+int markerStop = 0;         // Asks the marker to park
+int markerIdle = 0;         // The marker has run out of grey objects
+pthread_mutex_t markerLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t markerWake = PTHREAD_COND_INITIALIZER;
+pthread_cond_t markerDone = PTHREAD_COND_INITIALIZER;
+
+SweepMode sweepMode = SWEEP_EAGER;
+Collector collector = COLLECTOR_MARK_SWEEP;
+double compactThreshold = 0; // Compact at this much fragmentation (0 = never)
+Page** compactPages[NUM_OBJECT_TYPES]; // Each space's pages, in sliding order
+int compactCount[NUM_OBJECT_TYPES];
+int compactCapacity[NUM_OBJECT_TYPES];
+int* compactRanks = NULL;   // Live objects before each mark word, per page
+int compactRanksCapacity = 0;
+long compactions = 0;
+long pagesReturned = 0;     // Pages compaction gave back to the system
+double evacuateBelow = 0.25; // Immix: evacuate pages less full than this
+Treadmill treadmills[NUM_OBJECT_TYPES]; // One ring per space
+long evacuatedObjects = 0;  // Objects Immix has moved out of sparse pages
+Page** fromSpace = NULL;    // The pages being evacuated by a copying GC
+int fromSpaceCapacity = 0;
+Page** scanQueue = NULL;    // To-space pair pages, in the order they filled
+int scanQueueCount = 0;
+int scanQueueCapacity = 0;
+Page** sweepQueue = NULL;   // The pages that were in the heap at the last mark
+int sweepQueueCapacity = 0;
+int lazySweepNext = 0;      // Next page in sweepQueue to claim
+int lazySweepEnd = 0;       // How many pages are in sweepQueue
+long pagesSweptEager = 0;   // Pages swept inside a gc() pause
+long pagesSweptLazy = 0;    // Pages swept on demand by the allocator
+long pagesSweptBackground = 0; // Pages swept by the sweeper thread
+
+pthread_t sweeperThread;
+int sweeperStarted = 0;
+int sweeperBusy = 0;        // The sweeper is working through sweepQueue
+int sweeperStop = 0;        // Asks the sweeper to stop early
+pthread_mutex_t sweeperLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t sweeperWake = PTHREAD_COND_INITIALIZER;
+pthread_cond_t sweeperIdle = PTHREAD_COND_INITIALIZER;
+
+int gcWorkers = 1;           // Threads that take part in marking (incl. us)
+WorkDeque* markDeques = NULL; // One per worker
+int idleWorkers = 0;         // Workers that ran out of work (termination)
+int sweepCursor = 0;         // Next page for a sweep worker to claim
+Page** sweepList = NULL;     // The pages this sweep covers
+int sweepListCount = 0;
+int sweepKeepLists = 0;      // Leave the "has room" lists alone (minor GC)
+SweepResult sweepResults[MAX_GC_WORKERS];
+
+pthread_t* poolThreads = NULL; // The gcWorkers - 1 helper threads
+pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t poolWake = PTHREAD_COND_INITIALIZER;
+pthread_cond_t poolDone = PTHREAD_COND_INITIALIZER;
+GcTask poolTask = NULL;
+unsigned long poolGeneration = 0; // Bumped every time there's a new task
+unsigned long poolStartGeneration = 0; // poolGeneration when helpers started
+int poolPending = 0;              // Helpers still working on the task
+int poolShutdown = 0;
+
 
 
 /* Forward declarations */
 void gc(void);
+int sweepPage(Page* page);
+void startIncrementalMark(void);
+void markStep(void);
+void noteGcTime(double start, double end);
+Object* treadmillAlloc(ObjectType type);
+void resetTreadmills(void);
 void test1_ObjectsOnStack(void);
 void test2_UnreachedObjects(void);
 void test3_Reachability(void);
@@ -47,14 +657,168 @@ void test7_DeepRecursion(void);
 void test8_PartialDelete(void);
 void test9_FullClear(void);
 void test10_Reallocation(void);
+void test11_LongList(void);
+void test12_MarkStackOverflow(void);
+void test13_ParallelMark(void);
+void test14_LazySweep(void);
+void test15_ConcurrentSweep(void);
+void test16_MarkEpochFlip(void);
+void test17_ImmediateInts(void);
+void test18_LeafSpace(void);
+void test19_Generational(void);
+void test20_WriteBarrier(void);
+void test21_CopyingCollector(void);
+void test22_Compaction(void);
+void test23_Immix(void);
+void test24_IncrementalMark(void);
+void test25_ConcurrentMark(void);
+void test26_Treadmill(void);
+void test27_Metronome(void);
+void test28_GrowthPolicy(void);
+void setGcWorkers(int count);
+void setGenerational(int on);
+void setIncremental(int on);
+void setTimeScheduled(int on);
+void runBenchmarks(void);
 
 /**
- * Hey, this is where everything starts! We run all 10 tests to make sure our
+ * Hey, this is where everything starts! We run all the tests to make sure our
  * garbage collector actually works. These tests check everything from basic
  * stuff (like "don't delete things we're still using") to trickier scenarios
  * (like circular references that would normally cause memory leaks).
+ *
+ * Run it as "./main bench" to get the benchmarks instead, and add
+ * "--workers=N" to mark with N GC threads, "--sweep=lazy" to sweep on
+ * demand from the allocator, or "--sweep=concurrent" to sweep on a
+ * background thread. "--ints=immediate" stores integers as tagged words
+ * instead of heap objects. "--gen" collects generationally, with
+ * "--nursery=N" allocations between minor GCs and "--promote-age=N" (1-3)
+ * minor GCs survived before promotion. "--collector=copying" swaps
+ * mark-sweep for the semispace copying collector, "--collector=immix"
+ * for mark-region, which evacuates pages less than "--evacuate=F" full, and
+ * "--collector=treadmill" for Baker's treadmill.
+ * "--compact=F" makes mark-sweep compact the heap once F (0-1) of its pages
+ * are fragmentation. "--incremental" marks a bit at a time from the
+ * allocator, "--mark-rate=N" objects per allocation, in steps of at most
+ * "--pause-us=N" microseconds, and "--concurrent-mark" has a background
+ * thread do that marking instead. "--metronome" paces it by the clock:
+ * quanta of "--gc-quantum-us=N" that leave the mutator at least
+ * "--mmu=F" of every "--gc-window-us=N". "--growth=factor:F",
+ * "--growth=gogc:P", "--growth=live-ratio:F" and "--growth=max-heap:N"
+ * pick how the heap grows between collections, "--min-heap=N" is the
+ * smallest it's allowed to be, and "--heap-log" prints every decision.
  */
-int main() {
+int main(int argc, char** argv) {
+    int bench = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "bench") == 0) {
+            bench = 1;
+        } else if (strncmp(argv[i], "--workers=", 10) == 0) {
+            setGcWorkers(atoi(argv[i] + 10));
+        } else if (strcmp(argv[i], "--sweep=eager") == 0) {
+            sweepMode = SWEEP_EAGER;
+        } else if (strcmp(argv[i], "--sweep=lazy") == 0) {
+            sweepMode = SWEEP_LAZY;
+        } else if (strcmp(argv[i], "--sweep=concurrent") == 0) {
+            sweepMode = SWEEP_CONCURRENT;
+        } else if (strcmp(argv[i], "--ints=boxed") == 0) {
+            immediateInts = 0;
+        } else if (strcmp(argv[i], "--ints=immediate") == 0) {
+            immediateInts = 1;
+        } else if (strcmp(argv[i], "--gen") == 0) {
+            setGenerational(1);
+        } else if (strncmp(argv[i], "--nursery=", 10) == 0) {
+            nurserySize = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--promote-age=", 14) == 0) {
+            promotionAge = atoi(argv[i] + 14);
+            if (promotionAge < 1) promotionAge = 1;
+            if (promotionAge > 3) promotionAge = 3;
+        } else if (strcmp(argv[i], "--collector=mark-sweep") == 0) {
+            collector = COLLECTOR_MARK_SWEEP;
+        } else if (strcmp(argv[i], "--collector=copying") == 0) {
+            collector = COLLECTOR_COPYING;
+        } else if (strcmp(argv[i], "--collector=immix") == 0) {
+            collector = COLLECTOR_IMMIX;
+        } else if (strcmp(argv[i], "--collector=treadmill") == 0) {
+            if (!(WRITE_BARRIER & (BARRIER_SATB | BARRIER_DIJKSTRA))) {
+                printf("The treadmill needs BARRIER_SATB or BARRIER_DIJKSTRA"
+                       " in WRITE_BARRIER!\n");
+                exit(1);
+            }
+            collector = COLLECTOR_TREADMILL;
+        } else if (strncmp(argv[i], "--evacuate=", 11) == 0) {
+            evacuateBelow = atof(argv[i] + 11);
+        } else if (strncmp(argv[i], "--compact=", 10) == 0) {
+            compactThreshold = atof(argv[i] + 10);
+        } else if (strcmp(argv[i], "--incremental") == 0) {
+            setIncremental(1);
+        } else if (strncmp(argv[i], "--mark-rate=", 12) == 0) {
+            markWorkRatio = atoi(argv[i] + 12);
+            if (markWorkRatio < 1) markWorkRatio = 1;
+        } else if (strncmp(argv[i], "--pause-us=", 11) == 0) {
+            markStepMicros = atoi(argv[i] + 11);
+        } else if (strcmp(argv[i], "--concurrent-mark") == 0) {
+            setIncremental(1);
+            concurrentMark = 1;
+        } else if (strcmp(argv[i], "--metronome") == 0) {
+            timeScheduled = 1;
+        } else if (strncmp(argv[i], "--mmu=", 6) == 0) {
+            targetMmu = atof(argv[i] + 6);
+        } else if (strncmp(argv[i], "--gc-window-us=", 15) == 0) {
+            gcWindowMicros = atoi(argv[i] + 15);
+        } else if (strncmp(argv[i], "--gc-quantum-us=", 16) == 0) {
+            gcQuantumMicros = atoi(argv[i] + 16);
+        } else if (strncmp(argv[i], "--growth=factor:", 16) == 0) {
+            growthPolicy = GROWTH_FACTOR;
+            growthFactor = atof(argv[i] + 16);
+        } else if (strncmp(argv[i], "--growth=gogc:", 14) == 0) {
+            growthPolicy = GROWTH_GOGC;
+            gogcPercent = atoi(argv[i] + 14);
+        } else if (strncmp(argv[i], "--growth=live-ratio:", 20) == 0) {
+            growthPolicy = GROWTH_LIVE_RATIO;
+            targetLiveRatio = atof(argv[i] + 20);
+        } else if (strncmp(argv[i], "--growth=max-heap:", 18) == 0) {
+            growthPolicy = GROWTH_MAX_HEAP;
+            maxHeapObjects = atoi(argv[i] + 18);
+        } else if (strncmp(argv[i], "--min-heap=", 11) == 0) {
+            minHeapObjects = atoi(argv[i] + 11);
+        } else if (strcmp(argv[i], "--heap-log") == 0) {
+            heapLog = 1;
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (generational && collector != COLLECTOR_MARK_SWEEP) {
+        printf("--gen only works with the mark-sweep collector\n");
+        return 1;
+    }
+    if (growthFactor <= 1 || gogcPercent <= 0 || targetLiveRatio <= 0 ||
+        targetLiveRatio >= 1 || maxHeapObjects < 1) {
+        printf("--growth needs a factor above 1, a positive GOGC, a live ratio"
+               " between 0 and 1 and a positive heap cap\n");
+        return 1;
+    }
+    if (timeScheduled) {
+        if (concurrentMark) {
+            printf("--metronome paces marking itself, so no"
+                   " --concurrent-mark\n");
+            return 1;
+        }
+        setTimeScheduled(1);
+    }
+    if (incrementalMark &&
+        (generational || collector != COLLECTOR_MARK_SWEEP)) {
+        printf("--incremental only works with non-generational mark-sweep\n");
+        return 1;
+    }
+
+    if (bench) {
+        runBenchmarks();
+        return 0;
+    }
+
     test1_ObjectsOnStack();
     test2_UnreachedObjects();
     test3_Reachability();
@@ -65,37 +829,555 @@ int main() {
     test8_PartialDelete();
     test9_FullClear();
     test10_Reallocation();
+    test11_LongList();
+    test12_MarkStackOverflow();
+    test13_ParallelMark();
+    test14_LazySweep();
+    test15_ConcurrentSweep();
+    test16_MarkEpochFlip();
+    test17_ImmediateInts();
+    test18_LeafSpace();
+    test19_Generational();
+    test20_WriteBarrier();
+    test21_CopyingCollector();
+    test22_Compaction();
+    test23_Immix();
+    test24_IncrementalMark();
+    test25_ConcurrentMark();
+    test26_Treadmill();
+    test27_Metronome();
+    test28_GrowthPolicy();
+    return 0;
+}
+
+/**
+ * Wall-clock time in seconds. We use this rather than clock() for timing
+ * because clock() adds up CPU time across every thread, which hides exactly
+ * the speedup parallel phases are supposed to give us.
+ */
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Finds the page an object lives in.
+ *
+ * Pages are aligned to PAGE_SIZE, so chopping off the low bits of the
+ * object's address lands us right on the page header. No lookup needed.
+ */
+static inline Page* pageOf(Object* object) {
+    return (Page*)((uintptr_t)object & ~(uintptr_t)(PAGE_SIZE - 1));
+}
+
+/**
+ * Returns the first object slot in a page (right after the header).
+ */
+static inline Object* pageSlots(Page* page) {
+    return (Object*)((char*)page + PAGE_HEADER_SIZE);
+}
+
+/**
+ * What kind of object this is, read from its page header.
+ */
+static inline ObjectType objectType(Object* object) {
+    return pageOf(object)->type;
+}
+
+static inline int isInt(Object* object) {
+    return isImmediate(object) || objectType(object) == OBJ_INT;
+}
+
+static inline int intValue(Object* object) {
+    if (isImmediate(object)) return (int)((intptr_t)object >> 1);
+    return object->value;
+}
+
+/**
+ * The bits of mark word w that belong to real slots (the rest is padding).
+ */
+static inline uint64_t slotBits(int w) {
+    int remaining = SLOTS_PER_PAGE - w * 64;
+    if (remaining >= 64) return ~(uint64_t)0;
+    return remaining > 0 ? ((uint64_t)1 << remaining) - 1 : 0;
+}
+
+/**
+ * The value every mark word should hold between cycles, so that every slot
+ * reads as unmarked once the next cycle starts. Without epoch flipping that's
+ * just zero; with it, it's "all slots equal to this cycle's sense".
+ */
+static inline uint64_t idleMarkWord(int w) {
+    return markEpochFlip && markSense ? slotBits(w) : 0;
+}
+
+/**
+ * Which slots in mark word w are marked, whatever the current sense is.
+ */
+static inline uint64_t markedBits(const Page* page, int w) {
+    uint64_t bits = page->markBits[w];
+    return (markSense ? bits : ~bits) & slotBits(w);
+}
+
+/**
+ * Puts a page's whole bitmap into the between-cycles state.
+ */
+static void resetMarkBits(Page* page) {
+    for (int w = 0; w < (int)MARK_WORDS; w++) {
+        page->markBits[w] = idleMarkWord(w);
+    }
+    page->sweptEpoch = markEpoch;
+}
+
+/**
+ * For a page that turns up while a mark is already running: every slot has
+ * to read as unmarked right now (resetMarkBits() would get that backwards
+ * once the sense has flipped), and the next clearMarks() has to tidy it up.
+ */
+static void resetMarkBitsMidCycle(Page* page) {
+    for (int w = 0; w < (int)MARK_WORDS; w++) {
+        page->markBits[w] = markSense ? 0 : slotBits(w);
+    }
+    page->sweptEpoch = markEpoch - 1;
+}
+
+/**
+ * After sweeping (or, for pages the sweeper left alone, just before the
+ * next cycle), leaves a page's bitmap in the between-cycles state. With
+ * epoch flipping, words where every slot is in use are already there, so
+ * we only write the words that had dead or unused slots in them.
+ */
+static void finishMarkBits(Page* page) {
+    if (!markEpochFlip) return;
+    int written = 0;
+    for (int w = 0; w < (int)MARK_WORDS; w++) {
+        uint64_t idle = idleMarkWord(w);
+        if (page->markBits[w] != idle) {
+            page->markBits[w] = idle;
+            written++;
+        }
+    }
+    page->sweptEpoch = markEpoch;
+    if (written) {
+        __atomic_add_fetch(&bitmapBytesWritten, written * sizeof(uint64_t),
+                           __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Marks an object and tells us whether it was already marked.
+ *
+ * The bit lives in the page's side bitmap, indexed by the object's slot
+ * number, so the object itself is never written. Marking flips the bit to
+ * this cycle's sense.
+ */
+static inline int testAndSetMark(Object* object) {
+    Page* page = pageOf(object);
+    size_t index = (size_t)(object - pageSlots(page));
+    uint64_t* word = &page->markBits[index >> 6];
+    uint64_t bits = *word;
+    if ((int)((bits >> (index & 63)) & 1) == markSense) return 1;
+    *word = bits ^ ((uint64_t)1 << (index & 63));
+    markedObjects++;
     return 0;
 }
 
+/**
+ * Same as testAndSetMark(), but safe when several GC workers race on the
+ * same bitmap word. Only one of them gets to see the bit change.
+ */
+static inline int testAndSetMarkAtomic(Object* object) {
+    Page* page = pageOf(object);
+    size_t index = (size_t)(object - pageSlots(page));
+    uint64_t bit = (uint64_t)1 << (index & 63);
+    uint64_t* word = &page->markBits[index >> 6];
+    uint64_t marked = markSense ? bit : 0;
+    if ((__atomic_load_n(word, __ATOMIC_RELAXED) & bit) == marked) return 1;
+    uint64_t old = markSense ? __atomic_fetch_or(word, bit, __ATOMIC_RELAXED)
+                             : __atomic_fetch_and(word, ~bit, __ATOMIC_RELAXED);
+    return (old & bit) == marked;
+}
+
+/**
+ * True if a (heap) object has been promoted to the old generation.
+ */
+static inline int isOld(Object* object) {
+    Page* page = pageOf(object);
+    size_t index = (size_t)(object - pageSlots(page));
+    return (page->oldBits[index >> 6] >> (index & 63)) & 1;
+}
+
+/**
+ * Which card of its page an object lives in.
+ */
+static inline int cardOf(Object* object) {
+    return (int)(((uintptr_t)object & (PAGE_SIZE - 1)) >> CARD_SHIFT);
+}
+
+/**
+ * Adds a page to one of the page arrays (nurseryPages or dirtyPages).
+ */
+static void addPageTo(Page*** array, int* count, int* capacity, Page* page) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        *array = realloc(*array, *capacity * sizeof(Page*));
+        if (*array == NULL) {
+            printf("Out of memory!\n");
+            exit(1);
+        }
+    }
+    (*array)[(*count)++] = page;
+}
+
+/**
+ * Grabs a fresh page from the system for objects of the given type. Nothing
+ * in it has been handed out yet, so its whole slot area is one big bump
+ * region.
+ */
+Page* newPage(ObjectType type) {
+    Page* page = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+    if (page == NULL) {
+        printf("Out of memory!\n");
+        exit(1);
+    }
+
+    page->type = type;
+    page->evacuating = 0;
+    page->freeList = NULL;
+    page->bump = 0;
+    page->holes = 0;
+    page->holeLimit = 0;
+    page->inNursery = 0;
+    page->inDirtyList = 0;
+    page->youngObjects = 0;
+    page->cards = 0;
+    page->links = NULL;
+    memset(page->oldBits, 0, sizeof(page->oldBits));
+    memset(page->ageBits, 0, sizeof(page->ageBits));
+    page->inAvailList = 0;
+    page->nextAvail = NULL;
+    if (markingActive) resetMarkBitsMidCycle(page);
+    else resetMarkBits(page);
+
+    if (numPages == pageCapacity) {
+        pageCapacity = pageCapacity ? pageCapacity * 2 : 64;
+        pages = realloc(pages, pageCapacity * sizeof(Page*));
+        if (pages == NULL) {
+            printf("Out of memory!\n");
+            exit(1);
+        }
+    }
+    pages[numPages++] = page;
+    return page;
+}
+
+/**
+ * True if a swept page still has slots to hand out.
+ */
+static inline int pageHasRoom(const Page* page) {
+    return page->bump < SLOTS_PER_PAGE || page->freeList != NULL ||
+           page->holes > 0;
+}
+
+/**
+ * Puts a page back on the "has room" list for its type (if it isn't already
+ * there). Pages with nothing in them go to the empty page pool instead.
+ */
+static void makeAvailable(Page* page) {
+    if (!page->inAvailList) {
+        Page** list = page->bump == 0 ? &emptyPages
+                                      : &spaces[page->type].availPages;
+        page->nextAvail = *list;
+        *list = page;
+        page->inAvailList = 1;
+    }
+}
+
+/**
+ * Hands one of this thread's allocation buffers back to its page.
+ */
+static void retireBuffer(AllocBuffer* tlab) {
+    Page* page = tlab->page;
+    if (page == NULL) return;
+
+    pthread_mutex_lock(&heapLock);
+    // Once we've been taking lines, the page has no bump region of its own
+    page->bump = collector == COLLECTOR_IMMIX && tlab->holeWord >= 0
+                     ? SLOTS_PER_PAGE
+                     : (int)(tlab->cursor - pageSlots(page));
+    if (tlab->freeList != NULL) {
+        FreeSlot* last = tlab->freeList;
+        while (last->next) last = last->next;
+        last->next = page->freeList;
+        page->freeList = tlab->freeList;
+    }
+    page->holes = tlab->holes;
+    if (pageHasRoom(page)) makeAvailable(page);
+    pthread_mutex_unlock(&heapLock);
+
+    tlab->cursor = tlab->limit = NULL;
+    tlab->freeList = NULL;
+    tlab->holes = 0;
+    tlab->page = NULL;
+}
+
+/**
+ * Hands whatever is left in this thread's allocation buffers back to their
+ * pages.
+ *
+ * The GC calls this before sweeping so the pages' free lists and bump
+ * indexes are the whole truth again. Leftover recycled slots are spliced
+ * back onto each page's own free list.
+ */
+void retireAllocBuffer() {
+    for (int t = 0; t < NUM_OBJECT_TYPES; t++) {
+        retireBuffer(&tlabs[t]);
+    }
+}
+
+/**
+ * Lazy sweeping: sweeps unswept pages one at a time until one of them has
+ * room for objects of this type, and returns it. Pages of the other type
+ * that turn out to have room go on their own "has room" list. Returns NULL
+ * once every page has been swept. Called with heapLock held.
+ */
+static Page* lazySweepForPage(ObjectType type) {
+    for (;;) {
+        int next = __atomic_fetch_add(&lazySweepNext, 1, __ATOMIC_RELAXED);
+        if (next >= lazySweepEnd) break;
+        Page* page = sweepQueue[next];
+        sweepPage(page);
+        pagesSweptLazy++;
+        if (!pageHasRoom(page)) continue;
+        if (page->type == type || page->bump == 0) return page;
+        page->inAvailList = 0; // startLazySweep() emptied the lists
+        makeAvailable(page);
+    }
+    return NULL;
+}
+
+/**
+ * Sweeps the next unswept page, if there is one, and puts it on a "has
+ * room" list if it turns out to have any. This is how the lazy sweep gets
+ * finished off before an incremental mark starts.
+ */
+static void sweepAhead() {
+    int next = __atomic_fetch_add(&lazySweepNext, 1, __ATOMIC_RELAXED);
+    if (next >= lazySweepEnd) return;
+    Page* page = sweepQueue[next];
+    sweepPage(page);
+    pagesSweptLazy++;
+    if (pageHasRoom(page)) {
+        pthread_mutex_lock(&heapLock);
+        page->inAvailList = 0;
+        makeAvailable(page);
+        pthread_mutex_unlock(&heapLock);
+    }
+}
+
+/**
+ * Points this thread's allocation buffer for a type at a page that has
+ * room, taking the page's whole bump region and free list in one go. Partly
+ * used pages of that type go first, then empty pages from the pool (which
+ * can take either type). If every page is full (and, with lazy sweeping,
+ * every page has been swept) we make a new one.
+ */
+void refillAllocBuffer(ObjectType type) {
+    AllocBuffer* tlab = &tlabs[type];
+    retireBuffer(tlab);
+
+    pthread_mutex_lock(&heapLock);
+    Page* page = spaces[type].availPages;
+    if (page != NULL) {
+        spaces[type].availPages = page->nextAvail;
+    } else if ((page = emptyPages) != NULL) {
+        emptyPages = page->nextAvail;
+    } else if ((page = lazySweepForPage(type)) == NULL) {
+        page = newPage(type);
+    }
+    page->inAvailList = 0;
+    // Only pool pages change type; the marker thread may be reading the rest
+    if (page->type != type) page->type = type;
+    if (generational && !page->inNursery) {
+        // Everything we allocate here is young
+        page->inNursery = 1;
+        addPageTo(&nurseryPages, &numNurseryPages, &nurseryCapacity, page);
+    }
+
+    Object* slots = pageSlots(page);
+    tlab->page = page;
+    tlab->cursor = slots + page->bump;
+    tlab->limit = slots + SLOTS_PER_PAGE;
+    tlab->freeList = page->freeList;
+    tlab->holes = page->holes;
+    tlab->holeWord = -1;
+    tlab->holeBits = 0;
+    page->freeList = NULL;
+    page->holes = 0;
+    page->bump = SLOTS_PER_PAGE; // The buffer owns the rest of the page now
+    pthread_mutex_unlock(&heapLock);
+}
+
+/**
+ * Hands out the next hole in a leaf page, walking its mark bitmap one word
+ * at a time. A hole is a slot below holeLimit whose bit says "unmarked";
+ * flipping the bit claims it. Returns NULL when the page has none left.
+ */
+static Object* takeHole(AllocBuffer* tlab) {
+    Page* page = tlab->page;
+    while (tlab->holeBits == 0) {
+        int w = ++tlab->holeWord;
+        int remaining = page->holeLimit - w * 64;
+        if (remaining <= 0) {
+            tlab->holes = 0;
+            return NULL;
+        }
+        uint64_t used = remaining < 64 ? ((uint64_t)1 << remaining) - 1
+                                       : ~(uint64_t)0;
+        tlab->holeBits = ~markedBits(page, w) & used;
+    }
+    int bit = __builtin_ctzll(tlab->holeBits);
+    tlab->holeBits &= tlab->holeBits - 1;
+    page->markBits[tlab->holeWord] ^= (uint64_t)1 << bit;
+    tlab->holes--;
+    return &pageSlots(page)[tlab->holeWord * 64 + bit];
+}
+
+/**
+ * True if anything on a line survived the last mark.
+ */
+static inline int lineInUse(const Page* page, int line) {
+    int slot = line * LINE_SLOTS;
+    uint64_t lineBits = (((uint64_t)1 << LINE_SLOTS) - 1) << (slot & 63);
+    return (markedBits(page, slot >> 6) & lineBits) != 0;
+}
+
+/**
+ * Immix allocation: points the allocation buffer at the next run of free
+ * lines in its page, so allocation can go back to bumping. holeWord is the
+ * last line we handed out. Returns 0 when the page has no free lines left.
+ */
+static int takeLines(AllocBuffer* tlab) {
+    Page* page = tlab->page;
+    int line = tlab->holeWord + 1;
+    while (line < LINES_PER_PAGE && lineInUse(page, line)) line++;
+    if (line >= LINES_PER_PAGE) {
+        tlab->holes = 0;
+        return 0;
+    }
+    int end = line + 1;
+    while (end < LINES_PER_PAGE && !lineInUse(page, end)) end++;
+    tlab->holeWord = end - 1;
+    tlab->holes -= end - line;
+    int limit = end * LINE_SLOTS;
+    tlab->cursor = pageSlots(page) + line * LINE_SLOTS;
+    tlab->limit = pageSlots(page) +
+                  (limit < SLOTS_PER_PAGE ? limit : SLOTS_PER_PAGE);
+    return 1;
+}
+
+/**
+ * The slow path of allocation: the bump region is used up, so try the
+ * recycled slots we're holding, and failing that grab another page.
+ */
+Object* allocSlow(ObjectType type) {
+    AllocBuffer* tlab = &tlabs[type];
+    for (;;) {
+        if (tlab->cursor < tlab->limit) return tlab->cursor++;
+        if (tlab->freeList != NULL) {
+            FreeSlot* slot = tlab->freeList;
+            tlab->freeList = slot->next;
+            return (Object*)slot;
+        }
+        if (tlab->holes > 0 && collector == COLLECTOR_IMMIX) {
+            if (takeLines(tlab)) continue;
+        } else if (tlab->holes > 0) {
+            Object* object = takeHole(tlab);
+            if (object != NULL) return object;
+        }
+        refillAllocBuffer(type);
+    }
+}
+
+/**
+ * Hands every page back to the system. Only used when resetting the VM.
+ */
+void freeAllPages() {
+    for (int i = 0; i < numPages; i++) {
+        free(pages[i]->links);
+        free(pages[i]);
+    }
+    for (int t = 0; t < NUM_OBJECT_TYPES; t++) {
+        spaces[t].availPages = NULL;
+        tlabs[t].cursor = tlabs[t].limit = NULL;
+        tlabs[t].freeList = NULL;
+        tlabs[t].holes = 0;
+        tlabs[t].page = NULL;
+    }
+    emptyPages = NULL;
+    numPages = 0;
+    numNurseryPages = 0;
+    numDirtyPages = 0;
+}
+
 /**
  * Creates a new object (either an integer or a pair).
  * 
  * This is like asking for new space in memory. If we've hit our limit, we'll
- * run the garbage collector first to free up some room. The new object gets
- * added to our list of everything we've created, unmarked and ready to go.
- * If we completely run out of memory, we bail out.
+ * run the garbage collector first to free up some room. Most of the time the
+ * memory is just the next slot in our allocation buffer - a pointer bump -
+ * and only when that runs out do we go looking for another page. Each type
+ * has its own buffer, because pages only hold one type. The new object's
+ * slot was unmarked by the last sweep, so it's ready to go - unless an
+ * incremental mark is running, in which case we do a bit of marking first
+ * and the new object starts out black. An incremental mark doesn't start
+ * until a lazy sweep has been through every page, or the pages it never
+ * got to would pile up cycle after cycle, so until then every allocation
+ * sweeps a page. The treadmill has its own allocator.
  */
 Object* newObject(ObjectType type) {
-    // Run GC if we've reached max objects
-    if (numObjects == maxObjects) {
-        gc();
-    }
+    if (collector == COLLECTOR_TREADMILL) return treadmillAlloc(type);
 
-    // Allocate memory
-    Object* object = malloc(sizeof(Object));
-    if (object == NULL) {
-        printf("Out of memory!\n");
-        exit(1);
+    if (markingActive) {
+        markStep();
+    } else if (numObjects == maxObjects || markDeferred) {
+        // Run GC if we've reached max objects
+        if (incrementalMark && collector == COLLECTOR_MARK_SWEEP &&
+            !generational) {
+            // Starting a mark gives up on whatever the lazy sweep hasn't
+            // got to, so that gets swept first, a page per allocation
+            markDeferred = __atomic_load_n(&lazySweepNext, __ATOMIC_RELAXED) <
+                           lazySweepEnd;
+            if (markDeferred) sweepAhead();
+            else startIncrementalMark();
+        } else {
+            double start = nowSeconds();
+            gc();
+            noteGcTime(start, nowSeconds());
+        }
     }
 
-    object->type = type;
-    object->marked = 0; // Starts unmarked
+    // Fast path: bump the pointer in our allocation buffer
+    AllocBuffer* tlab = &tlabs[type];
+    Object* object = tlab->cursor;
+    if (object < tlab->limit) {
+        tlab->cursor = object + 1;
+    } else {
+        object = allocSlow(type);
+    }
 
-    // Add to linked list of all objects
-    object->next = firstObject;
-    firstObject = object;
     numObjects++;
+    if (markingActive) {
+        // Born black. The marker thread may be flipping bits in the same
+        // word, so then it has to be atomic
+        if (concurrentMark) {
+            testAndSetMarkAtomic(object);
+            markedObjects++;
+        } else {
+            testAndSetMark(object);
+        }
+    }
 
     return object;
 }
@@ -135,340 +1417,4754 @@ Object* pop() {
  * 
  * Instead of doing "create object, set value, push it" separately, this just
  * does it all at once. Super handy when you just want to work with numbers.
+ * With immediateInts on there's no object at all - just a tagged word.
  */
 Object* pushInt(int x) {
+    if (immediateInts) {
+        Object* obj = makeImmediate(x);
+        push(obj);
+        return obj;
+    }
     Object* obj = newObject(OBJ_INT);
     obj->value = x;
     push(obj);
     return obj;
 }
 
+static inline void dijkstraBarrier(Object* value);
+
 /**
  * Takes two things from the stack and combines them into a pair.
  * 
  * This is how we build more complex data structures. Grab the top two items,
  * bundle them together, and put the bundle back on the stack. Obviously need
- * at least two things on the stack for this to work!
+ * at least two things on the stack for this to work! A pair made during an
+ * incremental mark is already black, so the insertion barrier (if there is
+ * one) has to see its children.
  */
 Object* pushPair() {
     Object* obj = newObject(OBJ_PAIR);
     obj->tail = pop();
     obj->head = pop();
+#if WRITE_BARRIER & BARRIER_DIJKSTRA
+    dijkstraBarrier(obj->head);
+    dijkstraBarrier(obj->tail);
+#endif
     push(obj);
     return obj;
 }
 
-
-
 /**
- * Marks an object as "still in use, don't delete me!"
- * 
- * This is the heart of the "mark" part of mark-and-sweep. We tag this object
- * as important, and if it's a pair, we follow the references and mark those too.
- * We skip anything that's already marked or null to avoid infinite loops.
+ * Dirties the card an object lives in, and puts its page on the dirty list
+ * if it wasn't there already.
  */
-void mark(Object* object) {
-    // Skip if null or already marked (avoids infinite loops)
-    if (object == NULL || object->marked) return;
-
-    // Mark it
-    object->marked = 1;
-
-    // If pair, mark both parts
-    if (object->type == OBJ_PAIR) {
-        mark(object->head);
-        mark(object->tail);
+static void dirtyCard(Object* object) {
+    Page* page = pageOf(object);
+    uint64_t card = (uint64_t)1 << cardOf(object);
+    // Most stores hit a card that's already dirty - don't pay for the RMW
+    if (!(__atomic_load_n(&page->cards, __ATOMIC_RELAXED) & card)) {
+        __atomic_fetch_or(&page->cards, card, __ATOMIC_RELAXED);
+    }
+    if (!__atomic_load_n(&page->inDirtyList, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&heapLock);
+        if (!page->inDirtyList) {
+            addPageTo(&dirtyPages, &numDirtyPages, &dirtyCapacity, page);
+            __atomic_store_n(&page->inDirtyList, 1, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&heapLock);
     }
 }
 
 /**
- * Goes through everything on the stack and marks it all as important.
- * 
- * This kicks off the marking phase. Anything on the stack is something we're
- * actively using, so we mark it. The mark() function will then follow any
- * references to mark connected objects too.
+ * The card barrier. The only store a minor GC can't see on its own is an
+ * old pair getting a young child, so that's the one that dirties a card.
  */
-void markAll() {
-    for (int i = 0; i < stackSize; i++) {
-        mark(stack[i]);
+static inline void cardBarrier(Object* pair, Object* value) {
+    if (generational && isHeapObject(value) && isOld(pair) && !isOld(value)) {
+        dirtyCard(pair);
     }
 }
 
-
 /**
- * Cleans up all the garbage (unmarked objects).
- * 
- * This is the "sweep" part. We walk through all our objects - anything that
- * wasn't marked gets deleted because we're not using it anymore. For the
- * survivors, we reset their marks so we can do this again next time.
+ * Hands everything in the SATB log over to the marker thread, and wakes
+ * it up in case it was waiting for more.
  */
-void sweep() {
-    Object** object = &firstObject;
-    while (*object) {
-        if (!(*object)->marked) {
-            // Not marked = garbage, free it
-            Object* unreached = *object;
-            *object = unreached->next;
-            free(unreached);
-            numObjects--;
-        } else {
-            // Marked = alive, reset flag for next GC
-            (*object)->marked = 0;
-            object = &(*object)->next;
+static void flushSatbLog() {
+    pthread_mutex_lock(&markerLock);
+    if (markerQueueCount + satbCount > markerQueueCapacity) {
+        int capacity = markerQueueCapacity ? markerQueueCapacity : SATB_FLUSH;
+        while (capacity < markerQueueCount + satbCount) capacity *= 2;
+        Object** queue = realloc(markerQueue, capacity * sizeof(Object*));
+        if (queue == NULL) {
+            printf("Out of memory!\n");
+            exit(1);
         }
+        markerQueue = queue;
+        markerQueueCapacity = capacity;
     }
+    memcpy(markerQueue + markerQueueCount, satbLog,
+           satbCount * sizeof(Object*));
+    markerQueueCount += satbCount;
+    satbCount = 0;
+    pthread_cond_signal(&markerWake);
+    pthread_mutex_unlock(&markerLock);
 }
 
 /**
- * Runs the garbage collector - this is where the magic happens!
- * 
- * First we mark everything we're still using, then we sweep away the garbage.
- * After cleaning up, we adjust our limit (double what's left) so we don't have
- * to run this too often. Also prints out what happened so we can see it working.
+ * Remembers a pointer that's about to be overwritten, so the marker can
+ * still mark it once it drains the log. With a marker thread, a full log
+ * gets handed straight over.
  */
-void gc() {
-    int prevCount = numObjects;
-    
-    // Start Timer
-    clock_t start = clock();
-
-    markAll();
-    sweep();
+static void satbRecord(Object* object) {
+    if (satbCount == satbCapacity) {
+        int capacity = satbCapacity ? satbCapacity * 2 : SATB_LOG_INITIAL;
+        Object** log = realloc(satbLog, capacity * sizeof(Object*));
+        if (log == NULL) {
+            printf("Out of memory!\n");
+            exit(1);
+        }
+        satbLog = log;
+        satbCapacity = capacity;
+    }
+    satbLog[satbCount++] = object;
+    if (concurrentMark && satbCount >= SATB_FLUSH) flushSatbLog();
+}
 
-    // Stop Timer
-    clock_t end = clock();
-    double time_spent = (double)(end - start) / CLOCKS_PER_SEC;
+/**
+ * The SATB (snapshot-at-the-beginning) barrier. Everything reachable when
+ * marking started has to end up marked, so a pointer can't just vanish from
+ * the graph halfway through: we log the old value before it's overwritten.
+ */
+static inline void satbBarrier(Object* old) {
+    if (markingActive && isHeapObject(old)) satbRecord(old);
+}
 
-    if (maxObjects == 0) maxObjects = INITIAL_GC_THRESHOLD;
-    else maxObjects = numObjects * 2;
+static void pushMark(Object* object);
 
-    // Only print if we actually collected something or if it took measurable time
-    // This reduces spam during the big tests
-    if (prevCount - numObjects > 0) {
-        printf("GC Run: Collected %d | Remaining %d | Time: %f sec\n", 
-               prevCount - numObjects, numObjects, time_spent);
+/**
+ * Turns a white object grey: marks it and, if it's a pair, leaves it on the
+ * mark stack for its children to be looked at later.
+ */
+static void shade(Object* object) {
+    if (!testAndSetMark(object) && objectType(object) == OBJ_PAIR) {
+        pushMark(object);
     }
 }
 
 /**
- * Wipes everything clean so we can start fresh.
- * 
- * Between tests, we need to reset back to square one - empty stack, no objects,
- * original limits. This way each test starts with a clean slate and doesn't
- * interfere with the others.
+ * The Dijkstra (insertion) barrier. The marker may already be done with the
+ * pair we're storing into, so whatever we store gets shaded right away -
+ * a black object never ends up pointing at a white one. The marker thread
+ * owns the mark stack, and the treadmill shades by relinking, so with
+ * either of those we log the value for them instead.
  */
-void resetVM() {
-    // Reset all VM state so tests don't interfere
-    stackSize = 0;
-    firstObject = NULL;
-    numObjects = 0;
-    maxObjects = INITIAL_GC_THRESHOLD;
+static inline void dijkstraBarrier(Object* value) {
+    if (markingActive && isHeapObject(value)) {
+        if (concurrentMark || collector == COLLECTOR_TREADMILL) {
+            satbRecord(value);
+        } else {
+            shade(value);
+        }
+    }
 }
 
 /**
- * Test 1: Make sure we don't delete stuff we're still using!
- * 
- * The most basic rule - if something's on the stack, DON'T collect it.
- * We put two numbers on the stack, run GC, and both should still be there.
+ * The write barrier: runs before every pointer store into an existing pair,
+ * and is just whichever barriers WRITE_BARRIER compiled in.
  */
-void test1_ObjectsOnStack() {
-    printf("Test 1: Objects on stack should be preserved.\n");
-    resetVM();
-    pushInt(1);
-    pushInt(2);
-    gc();
-    
+static inline void writeBarrier(Object* pair, Object* old, Object* value) {
+#if WRITE_BARRIER & BARRIER_CARD
+    cardBarrier(pair, value);
+#endif
+#if WRITE_BARRIER & BARRIER_SATB
+    satbBarrier(old);
+#endif
+#if WRITE_BARRIER & BARRIER_DIJKSTRA
+    dijkstraBarrier(value);
+#endif
+    (void)pair;
+    (void)old;
+    (void)value;
 }
 
 /**
- * Test 2: Make sure we DO delete stuff we're not using anymore.
- * 
- * We create two objects, then immediately throw them away (pop them off).
- * When GC runs, it should find them and clean them up.
+ * Changes what a pair points to. Always use these (not pair->head = ...)
+ * once a pair exists, so the GC hears about the new pointer. The store is
+ * atomic (relaxed, so still a plain move on x86) because the marker thread
+ * may be reading the same field.
  */
-void test2_UnreachedObjects() {
-    printf("Test 2: Unreached objects should be collected.\n");
-    resetVM();
-    pushInt(1);
-    pushInt(2);
-    pop(); // Drop 2
-    pop(); // Drop 1
-    gc();
+static inline void setHead(Object* pair, Object* value) {
+    writeBarrier(pair, pair->head, value);
+    __atomic_store_n(&pair->head, value, __ATOMIC_RELAXED);
+}
+
+static inline void setTail(Object* pair, Object* value) {
+    writeBarrier(pair, pair->tail, value);
+    __atomic_store_n(&pair->tail, value, __ATOMIC_RELAXED);
 }
 
+
+
 /**
- * Test 3: Keep things we can reach indirectly.
- * 
- * We make a pair that contains two numbers. Even though the numbers aren't
- * directly on the stack, we can reach them through the pair, so all three
- * objects should stick around.
+ * Pushes a grey object onto the mark stack, growing the stack if needed.
+ *
+ * If the stack can't grow we just remember that we overflowed. The object
+ * is already marked, so nothing is lost - its children get picked up later
+ * when we rescan the heap.
  */
-void test3_Reachability() {
-    printf("Test 3: Reachability.\n");
-    resetVM();
-    pushInt(1);
-    pushInt(2);
-    pushPair(); // Pair holding 1 and 2
-    gc();
+static void pushMark(Object* object) {
+    if (markStackLimit > 0 && markStack.count >= markStackLimit) {
+        markStack.overflowed = 1;
+        return;
+    }
+    if (markStack.count == markStack.capacity) {
+        int capacity = markStack.capacity ? markStack.capacity * 2
+                                          : MARK_STACK_INITIAL;
+        if (markStackLimit > 0 && capacity > markStackLimit) {
+            capacity = markStackLimit;
+        }
+        Object** items = NULL;
+        if (capacity > markStack.capacity) {
+            items = realloc(markStack.items, capacity * sizeof(Object*));
+        }
+        if (items == NULL) {
+            markStack.overflowed = 1;
+            return;
+        }
+        markStack.items = items;
+        markStack.capacity = capacity;
+    }
+    markStack.items[markStack.count++] = object;
 }
 
 /**
- * Test 4: Handle circular references (the cool part!).
+ * Marks an object as "still in use, don't delete me!"
  * 
- * We create two pairs that point to each other in a circle. Even though they
- * reference each other, once we take them off the stack they're garbage.
- * This is where mark-and-sweep shines - reference counting would leak this!
+ * This is the heart of the "mark" part of mark-and-sweep. We tag this object
+ * as important, and if it's a pair, we put it on the mark stack so its
+ * references get marked too. Integers have nothing inside, so they never go
+ * on the stack. We skip anything that's already marked, null, or an
+ * immediate integer to avoid infinite loops.
  */
-void test4_Cycles() {
-    printf("Test 4: Cycles (The Mark-Sweep Advantage).\n");
-    resetVM();
-    // Create two pairs that reference each other
-    pushInt(1);
-    pushInt(2);
-    Object* a = pushPair(); // A points to 1 and 2
-    
-    pushInt(3);
-    pushInt(4);
-    Object* b = pushPair(); // B points to 3 and 4
-    
-    // Make them point to each other to create a cycle
-    a->tail = b;
-    b->tail = a;
+void mark(Object* object) {
+    // Skip if null or immediate, otherwise mark it - and stop if it was
+    // already marked (avoids infinite loops)
+    if (!isHeapObject(object) || testAndSetMark(object)) return;
 
-    // Remove both from stack
-    pop(); // Remove b
-    pop(); // Remove a
-    
-    // Mark-sweep handles cycles, reference counting would leak
-    gc();
-    
+    // If pair, its parts still need marking
+    if (objectType(object) == OBJ_PAIR) pushMark(object);
 }
+
 /**
- * Test 5: Make sure GC kicks in automatically when needed.
- * 
- * Our limit starts at 8 objects. When we try to create 10, GC should trigger
- * on its own at 8, clean up nothing (we're using everything), and grow the
- * limit so we can fit all 10.
+ * Marks everything a pair points to, following the tail in a loop.
+ *
+ * The head goes on the mark stack, but the tail we just walk into directly.
+ * That way a cons list (which grows through its tail) is marked without
+ * pushing anything at all. This is only the mark loop with markPrefetch
+ * off, though: the prefetching loop (the default) pushes tails like any
+ * other child, so they can wait in its FIFO while they're fetched.
  */
-void test5_HeapGrowth() {
-    printf("Test 5: Auto-trigger GC and Heap Growth.\n");
-    resetVM();
-    // maxObjects starts at 8
-    for (int i = 0; i < 10; i++) {
-        pushInt(i);
+static void scanPair(Object* object) {
+    while (object != NULL) {
+        mark(object->head);
+
+        Object* tail = object->tail;
+        object = NULL;
+        if (isHeapObject(tail) && !testAndSetMark(tail) &&
+            objectType(tail) == OBJ_PAIR) {
+            object = tail;
+        }
     }
-    
-    
 }
 
 /**
- * Test 6: Can we handle lots of rapid creation and deletion?
- * 
- * We create 1000 objects and immediately throw them all away in a loop.
- * This tests if the GC can keep up with lots of temporary objects without
- * leaking memory or getting confused.
+ * Marks a child we just found while scanning, prefetch style.
+ *
+ * We don't look inside the child here (that would be the cache miss we're
+ * trying to hide). We just set its mark bit, and if its page says it's a
+ * pair, ask the CPU to start fetching it and push it. Integers never need
+ * to be looked at at all.
  */
-void test6_PerformanceChurn() {
-    printf("Test 6: Performance & Scalability.\n");
-    
-    // test 3 different sizes to show the "linear" time increase
-    int sizes[] = {1000, 10000, 50000};
-    
-    for (int s = 0; s < 3; s++) {
-        int size = sizes[s];
-        printf(" Running stress test with %d objects\n", size);
-        
-        resetVM();
-        // Set a high threshold so GC doesn't trigger automatically during creation
-        maxObjects = size * 2; 
-        
-        for (int i = 0; i < size; i++) {
-            pushInt(i);
-            pop(); // Immediately make it garbage
+static inline void markPrefetched(Object* object) {
+    if (!isHeapObject(object) || testAndSetMark(object)) return;
+    if (objectType(object) != OBJ_PAIR) return;
+    __builtin_prefetch(object);
+    pushMark(object);
+}
+
+/**
+ * The prefetching version of the mark loop.
+ *
+ * Objects come off the mark stack into a little ring buffer and only get
+ * scanned once PREFETCH_FIFO_SIZE other objects have gone in behind them.
+ */
+static void processMarkStackPrefetch() {
+    Object* fifo[PREFETCH_FIFO_SIZE];
+    int head = 0;
+    int count = 0;
+
+    for (;;) {
+        // Keep the FIFO topped up from the mark stack
+        while (count < PREFETCH_FIFO_SIZE && markStack.count > 0) {
+            fifo[(head + count) % PREFETCH_FIFO_SIZE] =
+                markStack.items[--markStack.count];
+            count++;
         }
-        
-        // Manual trigger to measure the full sweep of 'size' garbage objects
-        gc(); 
+        if (count == 0) break;
+
+        Object* object = fifo[head];
+        head = (head + 1) % PREFETCH_FIFO_SIZE;
+        count--;
+
+        markPrefetched(object->head);
+        markPrefetched(object->tail);
     }
 }
 
 /**
- * Test 7: Can we handle really deep nested structures?
- * 
- * We build a linked list 20 layers deep (like a chain). This makes sure our
- * recursive marking doesn't crash when following long chains of references.
- * All 41 objects should survive.
+ * Keeps popping grey objects off the mark stack until it's empty.
  */
-void test7_DeepRecursion() {
-    printf("Test 7: Deep Recursion.\n");
-    resetVM();
-    pushInt(0);
-    for (int i = 0; i < 20; i++) {
-        pushInt(i);
-        pushPair();
+void processMarkStack() {
+    if (markPrefetch) {
+        processMarkStackPrefetch();
+        return;
+    }
+    while (markStack.count > 0) {
+        scanPair(markStack.items[--markStack.count]);
     }
-    gc();
-    // 1 Int + 20 * (1 Int + 1 Pair) = 41 objects
 }
 
 /**
- * Test 8: Delete some things but not others.
- * 
- * We create two objects but only throw away one. GC should be smart enough
- * to delete the one we don't need anymore while keeping the other.
+ * Recovers from a mark stack overflow.
+ *
+ * Some marked pairs never got their children looked at because there was no
+ * room to push them. We don't know which ones, so we walk every marked pair
+ * in the heap (skipping integer pages outright) and mark its children.
+ * Anything new goes on the (now empty) stack as usual. If that overflows
+ * again, we just go around again.
  */
-void test8_PartialDelete() {
-    printf("Test 8: Partial Deletion.\n");
-    resetVM();
-    // Push 2, pop 1
-    pushInt(10);
-    pushInt(20);
-    pop(); // 20 becomes garbage
-    gc();
-   
+void rescanHeap() {
+    markRescans++;
+    markStack.overflowed = 0;
+    for (int p = 0; p < numPages; p++) {
+        Page* page = pages[p];
+        if (page->type != OBJ_PAIR) continue;
+        Object* slots = pageSlots(page);
+        for (int w = 0; w < (int)MARK_WORDS; w++) {
+            uint64_t marks = markedBits(page, w);
+            while (marks) {
+                int bit = __builtin_ctzll(marks);
+                marks &= marks - 1;
+                Object* object = &slots[w * 64 + bit];
+                mark(object->head);
+                mark(object->tail);
+                processMarkStack();
+            }
+        }
+    }
 }
 
 /**
- * Test 9: If we clear everything, GC should clean up everything.
- * 
- * We make some objects, then manually clear the entire stack. Now nothing's
- * reachable, so GC should delete everything. Nuclear option!
+ * The body of each GC helper thread: sleep until there's a new task, run it,
+ * report back, repeat.
  */
-void test9_FullClear() {
-    printf("Test 9: Full Clear.\n");
-    resetVM();
-    pushInt(1);
-    pushInt(2);
-    pushPair();
-    // Clear entire stack
-    stackSize = 0;
-    gc();
-    
+static void* poolThreadMain(void* arg) {
+    int worker = (int)(intptr_t)arg;
+    unsigned long seen = poolStartGeneration;
+
+    pthread_mutex_lock(&poolLock);
+    for (;;) {
+        while (poolGeneration == seen && !poolShutdown) {
+            pthread_cond_wait(&poolWake, &poolLock);
+        }
+        if (poolShutdown) break;
+        seen = poolGeneration;
+        GcTask task = poolTask;
+        pthread_mutex_unlock(&poolLock);
+
+        task(worker);
+
+        pthread_mutex_lock(&poolLock);
+        if (--poolPending == 0) pthread_cond_signal(&poolDone);
+    }
+    pthread_mutex_unlock(&poolLock);
+    return NULL;
 }
 
 /**
- * Test 10: After cleaning up, can we use the memory again?
- * 
- * Create something, delete it, make sure it's really gone (NULL), then create
- * something new. This confirms we're actually freeing memory properly and can
- * reuse it.
+ * Runs a task on every GC worker at once - the helpers get ids 1..n-1 and
+ * the calling thread pitches in as worker 0. Returns once all of them are
+ * done.
  */
-void test10_Reallocation() {
-    printf("Test 10: Reallocation Reuse.\n");
-    resetVM();
-    pushInt(1);
-    pop();
-    gc(); // Free the int
-    Object* p1 = firstObject; // Should be NULL
-    
-    pushInt(2);
-    Object* p2 = firstObject; // Should have new object
-    
-}
+void runOnWorkers(GcTask task) {
+    if (gcWorkers == 1) {
+        task(0);
+        return;
+    }
 
+    pthread_mutex_lock(&poolLock);
+    poolTask = task;
+    poolPending = gcWorkers - 1;
+    poolGeneration++;
+    pthread_cond_broadcast(&poolWake);
+    pthread_mutex_unlock(&poolLock);
 
+    task(0);
 
+    pthread_mutex_lock(&poolLock);
+    while (poolPending > 0) pthread_cond_wait(&poolDone, &poolLock);
+    pthread_mutex_unlock(&poolLock);
+}
+
+/**
+ * Changes how many threads the GC uses. Stops the old helper threads, then
+ * starts count - 1 new ones and gives every worker an empty deque.
+ */
+void setGcWorkers(int count) {
+    if (count < 1) count = 1;
+    if (count > MAX_GC_WORKERS) count = MAX_GC_WORKERS;
+
+    if (poolThreads != NULL) {
+        pthread_mutex_lock(&poolLock);
+        poolShutdown = 1;
+        pthread_cond_broadcast(&poolWake);
+        pthread_mutex_unlock(&poolLock);
+        for (int i = 0; i < gcWorkers - 1; i++) {
+            pthread_join(poolThreads[i], NULL);
+        }
+        free(poolThreads);
+        poolThreads = NULL;
+        poolShutdown = 0;
+    }
+    for (int i = 0; i < gcWorkers && markDeques != NULL; i++) {
+        free(markDeques[i].array);
+    }
+    free(markDeques);
 
+    gcWorkers = count;
+    markDeques = aligned_alloc(64, count * sizeof(WorkDeque));
+    if (markDeques == NULL) {
+        printf("Out of memory!\n");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+        markDeques[i].top = 0;
+        markDeques[i].bottom = 0;
+        markDeques[i].array = malloc(sizeof(DequeArray) +
+                                     DEQUE_INITIAL * sizeof(Object*));
+        if (markDeques[i].array == NULL) {
+            printf("Out of memory!\n");
+            exit(1);
+        }
+        markDeques[i].array->capacity = DEQUE_INITIAL;
+        markDeques[i].array->retired = NULL;
+    }
 
+    if (count > 1) {
+        poolStartGeneration = poolGeneration;
+        poolThreads = malloc((count - 1) * sizeof(pthread_t));
+        if (poolThreads == NULL) {
+            printf("Out of memory!\n");
+            exit(1);
+        }
+        for (int i = 0; i < count - 1; i++) {
+            pthread_create(&poolThreads[i], NULL, poolThreadMain,
+                           (void*)(intptr_t)(i + 1));
+        }
+    }
+}
 
+/**
+ * Doubles a deque's array when the owner runs out of room.
+ *
+ * Thieves might still be reading the old array, so we can't free it yet.
+ * It goes on the new array's 'retired' chain and gets freed once marking
+ * is over and nobody can be looking at it.
+ */
+static DequeArray* growDeque(WorkDeque* deque, DequeArray* old,
+                             long top, long bottom) {
+    long capacity = old->capacity * 2;
+    DequeArray* array = malloc(sizeof(DequeArray) + capacity * sizeof(Object*));
+    if (array == NULL) {
+        printf("Out of memory!\n");
+        exit(1);
+    }
+    array->capacity = capacity;
+    array->retired = old;
+    for (long i = top; i < bottom; i++) {
+        array->items[i & (capacity - 1)] = old->items[i & (old->capacity - 1)];
+    }
+    __atomic_store_n(&deque->array, array, __ATOMIC_RELEASE);
+    return array;
+}
 
+/**
+ * Owner only: pushes a grey object onto the bottom of our deque.
+ */
+static void dequePush(WorkDeque* deque, Object* object) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    DequeArray* array = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+    if (bottom - top > array->capacity - 1) {
+        array = growDeque(deque, array, top, bottom);
+    }
+    __atomic_store_n(&array->items[bottom & (array->capacity - 1)], object,
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Owner only: takes the most recently pushed object back off the bottom.
+ * Returns NULL if the deque is empty (or a thief beat us to the last item).
+ */
+static Object* dequeTake(WorkDeque* deque) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    DequeArray* array = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    Object* object = NULL;
+    if (top <= bottom) {
+        object = __atomic_load_n(&array->items[bottom & (array->capacity - 1)],
+                                 __ATOMIC_RELAXED);
+        if (top == bottom) {
+            // Last item - race any thieves for it
+            if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                             __ATOMIC_SEQ_CST,
+                                             __ATOMIC_RELAXED)) {
+                object = NULL;
+            }
+            __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return object;
+}
+
+/**
+ * Anyone: tries to steal the oldest object from the top of a deque.
+ * Returns 1 and fills in *out on success, 0 if the deque is empty, and -1 if
+ * we lost a race and should try again.
+ */
+static int dequeSteal(WorkDeque* deque, Object** out) {
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) return 0;
+
+    DequeArray* array = __atomic_load_n(&deque->array, __ATOMIC_ACQUIRE);
+    Object* object = __atomic_load_n(&array->items[top & (array->capacity - 1)],
+                                     __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return -1;
+    }
+    *out = object;
+    return 1;
+}
+
+/**
+ * Parallel version of mark(): claims the object with an atomic test-and-set,
+ * and if it's a pair, pushes it onto this worker's deque.
+ */
+static inline void markParallel(WorkDeque* deque, Object* object) {
+    if (!isHeapObject(object) || testAndSetMarkAtomic(object)) return;
+    deque->marked++;
+    if (objectType(object) == OBJ_PAIR) dequePush(deque, object);
+}
+
+/**
+ * Parallel version of scanPair(): the head goes on our deque (where other
+ * workers can steal it), and we follow the tail ourselves.
+ */
+static void scanPairParallel(WorkDeque* deque, Object* object) {
+    while (object != NULL) {
+        markParallel(deque, object->head);
+
+        Object* tail = object->tail;
+        object = NULL;
+        if (isHeapObject(tail) && !testAndSetMarkAtomic(tail)) {
+            deque->marked++;
+            if (objectType(tail) == OBJ_PAIR) object = tail;
+        }
+    }
+}
+
+/**
+ * Looks through every other worker's deque for something to steal, starting
+ * just past our own so thieves spread out. Retries a victim if we lose a
+ * race on it.
+ */
+static int stealWork(int worker, Object** out) {
+    for (int i = 1; i < gcWorkers; i++) {
+        WorkDeque* victim = &markDeques[(worker + i) % gcWorkers];
+        int result;
+        while ((result = dequeSteal(victim, out)) < 0) {
+            // Lost a race, try the same victim again
+        }
+        if (result > 0) return 1;
+    }
+    return 0;
+}
+
+/**
+ * The termination protocol. A worker that's out of work (its own deque is
+ * empty and stealing failed) checks in as idle. Marking is done once every
+ * worker is idle at the same time - an idle worker never creates new work,
+ * so that can only happen when there's none left anywhere. If an idle worker
+ * spots work in someone's deque, it checks back out and goes to steal it.
+ */
+static int offerTermination() {
+    __atomic_add_fetch(&idleWorkers, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+        if (__atomic_load_n(&idleWorkers, __ATOMIC_SEQ_CST) == gcWorkers) {
+            return 1;
+        }
+        for (int i = 0; i < gcWorkers; i++) {
+            WorkDeque* deque = &markDeques[i];
+            if (__atomic_load_n(&deque->top, __ATOMIC_ACQUIRE) <
+                __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE)) {
+                __atomic_sub_fetch(&idleWorkers, 1, __ATOMIC_SEQ_CST);
+                return 0;
+            }
+        }
+        sched_yield();
+    }
+}
+
+/**
+ * What every GC worker runs during parallel marking.
+ *
+ * Each worker marks its own slice of the VM stack first, which seeds its
+ * deque. Then it drains its deque, steals when it runs dry, and stops once
+ * the termination protocol says everyone is out of work.
+ */
+static void parallelMarkTask(int worker) {
+    WorkDeque* deque = &markDeques[worker];
+
+    int chunk = (stackSize + gcWorkers - 1) / gcWorkers;
+    int first = worker * chunk;
+    int last = first + chunk < stackSize ? first + chunk : stackSize;
+    for (int i = first; i < last; i++) {
+        markParallel(deque, stack[i]);
+    }
+
+    for (;;) {
+        Object* object;
+        while ((object = dequeTake(deque)) != NULL) {
+            scanPairParallel(deque, object);
+        }
+        if (stealWork(worker, &object)) {
+            scanPairParallel(deque, object);
+            continue;
+        }
+        if (offerTermination()) break;
+    }
+}
+
+/**
+ * Marks everything reachable from the stack using all the GC workers, then
+ * frees any deque arrays that got outgrown along the way.
+ */
+void markAllParallel() {
+    idleWorkers = 0;
+    for (int i = 0; i < gcWorkers; i++) markDeques[i].marked = 0;
+    runOnWorkers(parallelMarkTask);
+
+    for (int i = 0; i < gcWorkers; i++) {
+        markedObjects += markDeques[i].marked;
+        DequeArray* array = markDeques[i].array;
+        while (array->retired != NULL) {
+            DequeArray* old = array->retired;
+            array->retired = old->retired;
+            free(old);
+        }
+    }
+}
+
+/**
+ * Goes through everything on the stack and marks it all as important.
+ * 
+ * This kicks off the marking phase. Anything on the stack is something we're
+ * actively using, so we mark it. Then we work through the mark stack until
+ * every reachable object has been marked, rescanning the heap if the mark
+ * stack ever overflowed along the way. With more than one GC worker, the
+ * parallel marker does all of this instead.
+ */
+void markAll() {
+    if (gcWorkers > 1) {
+        markAllParallel();
+        return;
+    }
+    for (int i = 0; i < stackSize; i++) {
+        mark(stack[i]);
+    }
+    processMarkStack();
+    while (markStack.overflowed) {
+        rescanHeap();
+    }
+}
+
+/**
+ * Immix evacuation: hands out a slot in a completely empty page to copy an
+ * object into. The pages with free lines can't be used here - marking is
+ * busy rewriting the bitmaps that say which lines are free.
+ */
+static Object* evacuationSlot(ObjectType type) {
+    AllocBuffer* tlab = &tlabs[type];
+    if (tlab->cursor == tlab->limit) {
+        retireBuffer(tlab);
+        pthread_mutex_lock(&heapLock);
+        Page* page = emptyPages;
+        if (page != NULL) {
+            emptyPages = page->nextAvail;
+        } else {
+            page = newPage(type);
+            resetMarkBitsMidCycle(page);
+        }
+        page->inAvailList = 0;
+        page->type = type;
+        page->bump = SLOTS_PER_PAGE; // The buffer owns the page now
+        pthread_mutex_unlock(&heapLock);
+        tlab->page = page;
+        tlab->cursor = pageSlots(page);
+        tlab->limit = pageSlots(page) + SLOTS_PER_PAGE;
+        tlab->holeWord = -1;
+    }
+    return tlab->cursor++;
+}
+
+/**
+ * Immix's version of mark(): marks an object and returns where it lives
+ * now. If it's in a page being evacuated it gets copied out first (unless
+ * that already happened, in which case its first word is the forwarding
+ * pointer), and the caller stores the new address back wherever it found
+ * the old one.
+ */
+static Object* immixTrace(Object* object) {
+    if (!isHeapObject(object)) return object;
+    Page* page = pageOf(object);
+    if (page->evacuating) {
+        if (testAndSetMark(object)) return object->head;
+        Object* copy = evacuationSlot(page->type);
+        *copy = *object;
+        object->head = copy;
+        object = copy;
+        testAndSetMark(copy);
+        evacuatedObjects++;
+    } else if (testAndSetMark(object)) {
+        return object;
+    }
+    if (page->type == OBJ_PAIR) pushMark(object);
+    return object;
+}
+
+/**
+ * The Immix mark: like markAll(), but every pointer is traced through
+ * immixTrace() and written back, so nothing points into an evacuated page
+ * afterwards. It always runs on this thread. If the mark stack overflows,
+ * we trace every marked pair outside the evacuated pages again, just like
+ * rescanHeap() does.
+ */
+void immixMarkAll() {
+    for (int i = 0; i < stackSize; i++) {
+        stack[i] = immixTrace(stack[i]);
+    }
+    for (;;) {
+        while (markStack.count > 0) {
+            Object* pair = markStack.items[--markStack.count];
+            pair->head = immixTrace(pair->head);
+            pair->tail = immixTrace(pair->tail);
+        }
+        if (!markStack.overflowed) break;
+
+        markRescans++;
+        markStack.overflowed = 0;
+        for (int p = 0; p < numPages; p++) {
+            Page* page = pages[p];
+            if (page->type != OBJ_PAIR || page->evacuating) continue;
+            Object* slots = pageSlots(page);
+            for (int w = 0; w < (int)MARK_WORDS; w++) {
+                uint64_t marks = markedBits(page, w);
+                while (marks) {
+                    Object* pair = &slots[w * 64 + __builtin_ctzll(marks)];
+                    marks &= marks - 1;
+                    pair->head = immixTrace(pair->head);
+                    pair->tail = immixTrace(pair->tail);
+                }
+            }
+        }
+    }
+}
+
+
+/**
+ * Makes every object in the heap white so a new cycle can start.
+ *
+ * Normally that's one memset per page - no objects are touched. With epoch
+ * flipping, the sweeper already left most swept pages in the right state,
+ * so we only fix up the pages it didn't (never swept, or leaf pages whose
+ * holes still say "free"), and then flip the sense.
+ */
+void clearMarks() {
+    markedObjects = 0;
+    for (int p = 0; p < numPages; p++) {
+        Page* page = pages[p];
+        if (!markEpochFlip) {
+            resetMarkBits(page);
+            bitmapBytesWritten += sizeof(page->markBits);
+        } else if (page->sweptEpoch != markEpoch) {
+            finishMarkBits(page);
+        }
+    }
+    if (markEpochFlip) markSense ^= 1;
+    markEpoch++;
+}
+
+/**
+ * Turns epoch flipping on or off. The bitmaps mean different things in the
+ * two modes, so every page gets reset and we start from sense 1.
+ */
+void setEpochFlip(int on) {
+    markEpochFlip = on;
+    markSense = 1;
+    for (int p = 0; p < numPages; p++) {
+        resetMarkBits(pages[p]);
+    }
+}
+
+/**
+ * Counts the set bits in a page's mark bitmap.
+ *
+ * With AVX2 (or SSSE3) this works on 256 (or 128) bits at a time using the
+ * nibble-lookup popcount: split every byte into two 4-bit halves, look up
+ * each half's bit count with a byte shuffle, and add the bytes up with SAD.
+ * Without either, it's one popcount per 64-bit word.
+ */
+static inline int countSetBits(const Page* page) {
+#if defined(__AVX2__)
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                            1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3,
+                                            1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i total = _mm256_setzero_si256();
+    for (size_t w = 0; w < MARK_WORDS; w += 4) {
+        __m256i bits = _mm256_load_si256((const __m256i*)&page->markBits[w]);
+        __m256i low =
+            _mm256_shuffle_epi8(lookup, _mm256_and_si256(bits, nibble));
+        __m256i high = _mm256_shuffle_epi8(
+            lookup, _mm256_and_si256(_mm256_srli_epi16(bits, 4), nibble));
+        total = _mm256_add_epi64(total,
+                                 _mm256_sad_epu8(_mm256_add_epi8(low, high),
+                                                 _mm256_setzero_si256()));
+    }
+    return (int)(_mm256_extract_epi64(total, 0) +
+                 _mm256_extract_epi64(total, 1) +
+                 _mm256_extract_epi64(total, 2) +
+                 _mm256_extract_epi64(total, 3));
+#elif defined(__SSSE3__)
+    const __m128i lookup = _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    __m128i total = _mm_setzero_si128();
+    for (size_t w = 0; w < MARK_WORDS; w += 2) {
+        __m128i bits = _mm_load_si128((const __m128i*)&page->markBits[w]);
+        __m128i low = _mm_shuffle_epi8(lookup, _mm_and_si128(bits, nibble));
+        __m128i high = _mm_shuffle_epi8(
+            lookup, _mm_and_si128(_mm_srli_epi16(bits, 4), nibble));
+        total = _mm_add_epi64(total, _mm_sad_epu8(_mm_add_epi8(low, high),
+                                                  _mm_setzero_si128()));
+    }
+    return (int)(_mm_cvtsi128_si64(total) +
+                 _mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total)));
+#else
+    int live = 0;
+    for (size_t w = 0; w < MARK_WORDS; w++) {
+        live += __builtin_popcountll(page->markBits[w]);
+    }
+    return live;
+#endif
+}
+
+/**
+ * Counts how many objects in a page are marked - that is, how many
+ * survived. When the sense is 0 the marked slots are the clear bits, and
+ * since padding bits are always 0 we count clear bits among real slots only.
+ */
+static inline int countMarks(const Page* page) {
+    int set = countSetBits(page);
+    return markSense ? set : SLOTS_PER_PAGE - set;
+}
+
+/**
+ * Sweeps a single page and rebuilds its free list.
+ *
+ * First we just count the page's mark bits. If nothing survived, the whole
+ * page goes back to being one big bump region - we don't touch a single
+ * object in it, so a page full of garbage costs the same as an empty one.
+ * If everything below the bump index survived there's nothing to free.
+ *
+ * A leaf page stops there: its unmarked slots below the bump index are its
+ * holes, and the allocator finds them in the bitmap itself. For a pointer
+ * page we read the bitmap a 64-bit word at a time. Every unmarked slot
+ * below the bump index is a free slot (either garbage from this cycle or
+ * already free), so it goes on a brand new free list in address order and
+ * the allocator hands slots out front to back. Survivors aren't touched at
+ * all. Returns how many objects in the page are still alive; putting the
+ * page on the right list is up to the caller.
+ */
+static int sweepPageSlots(Page* page) {
+    int live = countMarks(page);
+    if (page->bump > 0) {
+        Space* space = &spaces[page->type];
+        __atomic_add_fetch(&space->liveObjects, live, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&space->pagesSwept, 1, __ATOMIC_RELAXED);
+    }
+    page->holes = 0;
+    page->holeLimit = 0;
+    if (live == 0) {
+        if (page->bump > 0) {
+            __atomic_add_fetch(&pagesReleased, 1, __ATOMIC_RELAXED);
+        }
+        page->freeList = NULL;
+        page->bump = 0;
+        finishMarkBits(page);
+        return 0;
+    }
+    if (live == page->bump) {
+        page->freeList = NULL;
+        finishMarkBits(page);
+        return live;
+    }
+    if (isLeafType(page->type) && !generational) {
+        // The bitmap already says which slots are free; leave it as it is
+        page->freeList = NULL;
+        page->holes = page->bump - live;
+        page->holeLimit = page->bump;
+        return live;
+    }
+
+    Object* slots = pageSlots(page);
+    FreeSlot* freeHead = NULL;
+    FreeSlot** freeTail = &freeHead;
+    int words = (page->bump + 63) / 64;
+
+    for (int w = 0; w < words; w++) {
+        // Only slots below the bump index have ever been handed out
+        uint64_t used = ~(uint64_t)0;
+        int remaining = page->bump - w * 64;
+        if (remaining < 64) used = ((uint64_t)1 << remaining) - 1;
+
+        uint64_t dead = ~markedBits(page, w) & used;
+        while (dead) {
+            int bit = __builtin_ctzll(dead);
+            dead &= dead - 1;
+            FreeSlot* slot = (FreeSlot*)&slots[w * 64 + bit];
+            *freeTail = slot;
+            freeTail = &slot->next;
+        }
+    }
+    *freeTail = NULL;
+    page->freeList = freeHead;
+    finishMarkBits(page);
+    return live;
+}
+
+/**
+ * Generational bookkeeping for a page we just swept.
+ *
+ * Works a bitmap word at a time: every young survivor gets a year older
+ * (a bit-sliced 2-bit add), the ones that reach promotionAge become old,
+ * and dead slots forget their age and old bit. Then the mark bits are set
+ * to exactly the old objects, so they stay marked (sticky) and everything
+ * else starts the next collection unmarked. Promoted pairs dirty their
+ * cards, since their children may still be young.
+ */
+static void finishGenerations(Page* page) {
+    int young = 0;
+    int promoted = 0;
+    for (int w = 0; w < (SLOTS_PER_PAGE + 63) / 64; w++) {
+        uint64_t marked = markedBits(page, w);
+        uint64_t old = page->oldBits[w] & marked;
+        uint64_t survivors = marked & ~old;
+
+        uint64_t lo = page->ageBits[0][w];
+        uint64_t hi = page->ageBits[1][w];
+        hi ^= lo & survivors;
+        lo ^= survivors;
+        uint64_t ripe = promotionAge >= 3 ? lo & hi
+                      : promotionAge == 2 ? hi
+                      : lo | hi;
+        uint64_t promote = survivors & ripe;
+
+        old |= promote;
+        page->oldBits[w] = old;
+        page->ageBits[0][w] = lo & marked & ~old;
+        page->ageBits[1][w] = hi & marked & ~old;
+        page->markBits[w] = markSense ? old : ~old & slotBits(w);
+
+        young += __builtin_popcountll(survivors & ~promote);
+        promoted += __builtin_popcountll(promote);
+        if (page->type == OBJ_PAIR) {
+            while (promote) {
+                int bit = __builtin_ctzll(promote);
+                promote &= promote - 1;
+                Object* object = &pageSlots(page)[w * 64 + bit];
+                page->cards |= (uint64_t)1 << cardOf(object);
+            }
+        }
+    }
+    page->youngObjects = young;
+    __atomic_add_fetch(&youngSurvived, young, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&promotedObjects, promoted, __ATOMIC_RELAXED);
+}
+
+/**
+ * Immix's sweep of a single page: no free list, not even a look at the
+ * objects. A page nothing survived in (or one we just evacuated) is empty
+ * again. Otherwise we count its free lines, which the allocator will bump
+ * through, unless so little survived that the page is better off being
+ * evacuated at the next mark - then it gets no allocations until then.
+ * The bitmap stays as it is, since it's what says which lines are free.
+ */
+static int sweepPageLines(Page* page) {
+    page->freeList = NULL;
+    page->holeLimit = 0;
+    if (page->evacuating) {
+        page->evacuating = 0;
+        page->bump = 0;
+        page->holes = 0;
+        finishMarkBits(page);
+        return 0;
+    }
+
+    int live = countMarks(page);
+    if (page->bump > 0) {
+        Space* space = &spaces[page->type];
+        __atomic_add_fetch(&space->liveObjects, live, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&space->pagesSwept, 1, __ATOMIC_RELAXED);
+    }
+    if (live == 0) {
+        if (page->bump > 0) {
+            __atomic_add_fetch(&pagesReleased, 1, __ATOMIC_RELAXED);
+        }
+        page->bump = 0;
+        page->holes = 0;
+        finishMarkBits(page);
+        return 0;
+    }
+
+    int freeLines = 0;
+    for (int line = 0; line < LINES_PER_PAGE; line++) {
+        freeLines += !lineInUse(page, line);
+    }
+    page->bump = SLOTS_PER_PAGE;
+    page->holes = freeLines;
+    if (live < evacuateBelow * SLOTS_PER_PAGE) {
+        page->evacuating = 1;
+        page->holes = 0;
+    }
+    return live;
+}
+
+/**
+ * Sweeps one page (see sweepPageSlots()), then does the generational
+ * bookkeeping if we're collecting generationally. Immix sweeps by lines
+ * instead (see sweepPageLines()).
+ */
+int sweepPage(Page* page) {
+    if (collector == COLLECTOR_IMMIX) return sweepPageLines(page);
+    int live = sweepPageSlots(page);
+    if (generational) finishGenerations(page);
+    return live;
+}
+
+/**
+ * Tacks a page onto the end of a list built through nextAvail.
+ */
+static inline void appendPage(Page** head, Page** tail, Page* page) {
+    page->nextAvail = NULL;
+    if (*tail) (*tail)->nextAvail = page;
+    else *head = page;
+    *tail = page;
+}
+
+/**
+ * What every GC worker runs during the sweep.
+ *
+ * Grab the next chunk of pages, sweep them, remember the ones with room (and
+ * separately, the ones that are now completely empty) in our own lists, and
+ * repeat until the pages run out.
+ */
+static void sweepTask(int worker) {
+    SweepResult* result = &sweepResults[worker];
+    for (int t = 0; t < NUM_OBJECT_TYPES; t++) {
+        result->availHead[t] = result->availTail[t] = NULL;
+    }
+    result->emptyHead = result->emptyTail = NULL;
+    result->live = 0;
+
+    for (;;) {
+        int first = __atomic_fetch_add(&sweepCursor, SWEEP_CHUNK,
+                                       __ATOMIC_RELAXED);
+        if (first >= sweepListCount) break;
+        int last = first + SWEEP_CHUNK < sweepListCount ? first + SWEEP_CHUNK
+                                                        : sweepListCount;
+
+        for (int p = first; p < last; p++) {
+            Page* page = sweepList[p];
+            result->live += sweepPage(page);
+            if (sweepKeepLists) continue;
+
+            page->inAvailList = pageHasRoom(page);
+            if (!page->inAvailList) continue;
+            if (page->bump == 0) {
+                appendPage(&result->emptyHead, &result->emptyTail, page);
+            } else {
+                appendPage(&result->availHead[page->type],
+                           &result->availTail[page->type], page);
+            }
+        }
+    }
+}
+
+/**
+ * Cleans up all the garbage (unmarked objects).
+ * 
+ * This is the "sweep" part. We walk through every page in the heap - anything
+ * that wasn't marked goes back to its page's free list because we're not using
+ * it anymore. Survivors keep their mark bits until the next cycle wipes the
+ * bitmaps in one go. Pages are contiguous, so this is a nice linear scan the
+ * hardware prefetcher can keep up with.
+ *
+ * The pages are split up between all the GC workers, and the "has room" list
+ * and the empty page pool are rebuilt from scratch out of each worker's
+ * private lists.
+ */
+void sweep() {
+    sweepCursor = 0;
+    sweepList = pages;
+    sweepListCount = numPages;
+    sweepKeepLists = 0;
+    runOnWorkers(sweepTask);
+    pagesSweptEager += numPages;
+
+    Page* availTail[NUM_OBJECT_TYPES] = {NULL};
+    Page* emptyTail = NULL;
+    emptyPages = NULL;
+    for (int t = 0; t < NUM_OBJECT_TYPES; t++) spaces[t].availPages = NULL;
+    long live = 0;
+    for (int i = 0; i < gcWorkers; i++) {
+        SweepResult* result = &sweepResults[i];
+        live += result->live;
+        for (int t = 0; t < NUM_OBJECT_TYPES; t++) {
+            if (result->availHead[t] == NULL) continue;
+            if (availTail[t]) availTail[t]->nextAvail = result->availHead[t];
+            else spaces[t].availPages = result->availHead[t];
+            availTail[t] = result->availTail[t];
+        }
+        if (result->emptyHead != NULL) {
+            if (emptyTail) emptyTail->nextAvail = result->emptyHead;
+            else emptyPages = result->emptyHead;
+            emptyTail = result->emptyTail;
+        }
+    }
+    numObjects = (int)live;
+}
+
+/**
+ * Sets up a lazy sweep instead of sweeping now.
+ *
+ * Marking already told us exactly how many objects are alive, so the object
+ * count is right straight away. Every page is unswept, so none of their free
+ * lists can be trusted - the "has room" list starts empty and the allocator
+ * sweeps pages as it goes. Pages a previous cycle never got around to just
+ * join the queue: whatever was garbage then is still unmarked now.
+ *
+ * The queue is a copy of the page array, because the allocator may grow (and
+ * move) the real one while the background sweeper is still reading.
+ */
+void startLazySweep() {
+    numObjects = (int)markedObjects;
+    for (int t = 0; t < NUM_OBJECT_TYPES; t++) spaces[t].availPages = NULL;
+    emptyPages = NULL;
+
+    if (sweepQueueCapacity < numPages) {
+        sweepQueueCapacity = pageCapacity;
+        sweepQueue = realloc(sweepQueue, sweepQueueCapacity * sizeof(Page*));
+        if (sweepQueue == NULL) {
+            printf("Out of memory!\n");
+            exit(1);
+        }
+    }
+    if (numPages > 0) memcpy(sweepQueue, pages, numPages * sizeof(Page*));
+    lazySweepNext = 0;
+    lazySweepEnd = numPages;
+}
+
+/**
+ * The background sweeper thread.
+ *
+ * It sleeps until a GC hands it a sweep queue, then claims pages one at a
+ * time, sweeps them, and puts any page with room on the "has room" list for
+ * the allocator. The only lock it takes is heapLock, once per page, to hand
+ * the page over. It stops when the queue runs out or gc() asks it to.
+ */
+static void* sweeperMain(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&sweeperLock);
+    for (;;) {
+        while (!sweeperBusy) pthread_cond_wait(&sweeperWake, &sweeperLock);
+        pthread_mutex_unlock(&sweeperLock);
+
+        while (!__atomic_load_n(&sweeperStop, __ATOMIC_ACQUIRE)) {
+            int next = __atomic_fetch_add(&lazySweepNext, 1, __ATOMIC_RELAXED);
+            if (next >= lazySweepEnd) break;
+            Page* page = sweepQueue[next];
+            sweepPage(page);
+            __atomic_add_fetch(&pagesSweptBackground, 1, __ATOMIC_RELAXED);
+
+            if (pageHasRoom(page)) {
+                pthread_mutex_lock(&heapLock);
+                page->inAvailList = 0;
+                makeAvailable(page);
+                pthread_mutex_unlock(&heapLock);
+            }
+        }
+
+        pthread_mutex_lock(&sweeperLock);
+        sweeperBusy = 0;
+        pthread_cond_broadcast(&sweeperIdle);
+    }
+    return NULL;
+}
+
+/**
+ * Wakes the background sweeper to work through the current sweep queue,
+ * starting the thread the first time we need it.
+ */
+void startBackgroundSweep() {
+    pthread_mutex_lock(&sweeperLock);
+    if (!sweeperStarted) {
+        pthread_create(&sweeperThread, NULL, sweeperMain, NULL);
+        sweeperStarted = 1;
+    }
+    sweeperBusy = 1;
+    pthread_cond_signal(&sweeperWake);
+    pthread_mutex_unlock(&sweeperLock);
+}
+
+/**
+ * Makes the background sweeper stop (after the page it's on) and waits
+ * until it has. Pages it didn't get to are simply swept in a later cycle.
+ */
+void stopBackgroundSweep() {
+    if (!sweeperStarted) return;
+    __atomic_store_n(&sweeperStop, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&sweeperLock);
+    while (sweeperBusy) pthread_cond_wait(&sweeperIdle, &sweeperLock);
+    pthread_mutex_unlock(&sweeperLock);
+    __atomic_store_n(&sweeperStop, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Works out which slots of a page live in a given card.
+ */
+static void cardSlots(int card, int* first, int* last) {
+    long start = (long)card * CARD_SIZE - (long)PAGE_HEADER_SIZE;
+    long end = start + CARD_SIZE;
+    long size = (long)sizeof(Object);
+    *first = start <= 0 ? 0 : (int)((start + size - 1) / size);
+    *last = end <= 0 ? 0 : (int)((end + size - 1) / size);
+    if (*last > SLOTS_PER_PAGE) *last = SLOTS_PER_PAGE;
+}
+
+static inline int pointsYoung(Object* object) {
+    return isHeapObject(object) && !isOld(object);
+}
+
+/**
+ * The extra roots of a minor GC: every old pair in a dirty card might be
+ * pointing at a young object, so we mark its children.
+ */
+static void markCards() {
+    for (int d = 0; d < numDirtyPages; d++) {
+        Page* page = dirtyPages[d];
+        if (page->type != OBJ_PAIR) continue;
+        Object* slots = pageSlots(page);
+        uint64_t cards = page->cards;
+        while (cards) {
+            int card = __builtin_ctzll(cards);
+            cards &= cards - 1;
+            int first, last;
+            cardSlots(card, &first, &last);
+            for (int i = first; i < last; i++) {
+                if (!((page->oldBits[i >> 6] >> (i & 63)) & 1)) continue;
+                mark(slots[i].head);
+                mark(slots[i].tail);
+            }
+        }
+    }
+    processMarkStack();
+    while (markStack.overflowed) {
+        rescanHeap();
+    }
+}
+
+/**
+ * After sweeping, keeps only the cards that still have an old pair
+ * pointing at a young object, and drops pages with no dirty cards left
+ * from dirtyPages.
+ */
+static void cleanCards() {
+    int kept = 0;
+    for (int d = 0; d < numDirtyPages; d++) {
+        Page* page = dirtyPages[d];
+        uint64_t cards = page->type == OBJ_PAIR ? page->cards : 0;
+        uint64_t keep = 0;
+        Object* slots = pageSlots(page);
+        while (cards) {
+            int card = __builtin_ctzll(cards);
+            cards &= cards - 1;
+            int first, last;
+            cardSlots(card, &first, &last);
+            for (int i = first; i < last; i++) {
+                if (!((page->oldBits[i >> 6] >> (i & 63)) & 1)) continue;
+                if (pointsYoung(slots[i].head) || pointsYoung(slots[i].tail)) {
+                    keep |= (uint64_t)1 << card;
+                    break;
+                }
+            }
+        }
+        page->cards = keep;
+        if (keep) dirtyPages[kept++] = page;
+        else page->inDirtyList = 0;
+    }
+    numDirtyPages = kept;
+}
+
+/**
+ * After sweeping, tidies up the nursery: pages whose young objects all
+ * died or got promoted leave it, and pages where promotion dirtied a card
+ * join dirtyPages. After a minor sweep, nursery pages with room also go
+ * back on their "has room" list (a full sweep rebuilt those lists already).
+ */
+static void finishNursery(int minor) {
+    int kept = 0;
+    for (int n = 0; n < numNurseryPages; n++) {
+        Page* page = nurseryPages[n];
+        if (page->cards && !page->inDirtyList) {
+            page->inDirtyList = 1;
+            addPageTo(&dirtyPages, &numDirtyPages, &dirtyCapacity, page);
+        }
+        if (minor && pageHasRoom(page)) makeAvailable(page);
+        if (page->youngObjects > 0) nurseryPages[kept++] = page;
+        else page->inNursery = 0;
+    }
+    numNurseryPages = kept;
+    cleanCards();
+    youngObjects = (int)youngSurvived;
+    lastGcObjects = numObjects;
+    maxObjects = numObjects + nurserySize;
+}
+
+/**
+ * A minor collection: marks the young objects reachable from the roots and
+ * the dirty cards, and sweeps only the nursery pages. Old objects are
+ * already marked, so neither phase ever walks them - the pause depends on
+ * the nursery, not the heap.
+ */
+void minorGc() {
+    int prevCount = numObjects;
+    double start = nowSeconds();
+
+    retireAllocBuffer();
+    int youngBefore = youngObjects + (numObjects - lastGcObjects);
+    long promotedBefore = promotedObjects;
+    markedObjects = 0;
+    markCards();
+    markAll();
+    numObjects = numObjects - youngBefore + (int)markedObjects;
+
+    for (int t = 0; t < NUM_OBJECT_TYPES; t++) {
+        spaces[t].liveObjects = 0;
+        spaces[t].pagesSwept = 0;
+    }
+    youngSurvived = 0;
+    sweepCursor = 0;
+    sweepList = nurseryPages;
+    sweepListCount = numNurseryPages;
+    sweepKeepLists = 1;
+    runOnWorkers(sweepTask);
+    pagesSweptEager += numNurseryPages;
+    finishNursery(1);
+    minorCollections++;
+
+    lastGcPause = nowSeconds() - start;
+    if (gcLog && prevCount - numObjects > 0) {
+        printf("Minor GC: Collected %d | Remaining %d | Promoted %ld |"
+               " Time: %f sec\n", prevCount - numObjects, numObjects,
+               promotedObjects - promotedBefore, lastGcPause);
+    }
+}
+
+/**
+ * Turns generational collection on or off. The old bits, ages and cards
+ * all start from nothing, so only do this with an empty heap (right after
+ * resetVM()). Sticky mark bits and a flipping mark sense can't share the
+ * bitmap, so generational mode turns epoch flipping off (and back on).
+ * Minor GCs rely on the card barrier, so it has to be compiled in.
+ */
+void setGenerational(int on) {
+    if (on && !(WRITE_BARRIER & BARRIER_CARD)) {
+        printf("Generational mode needs BARRIER_CARD in WRITE_BARRIER!\n");
+        exit(1);
+    }
+    generational = on;
+    setEpochFlip(!on);
+    youngObjects = lastGcObjects = 0;
+    fullGcThreshold = nurserySize;
+}
+
+/**
+ * How fragmented the heap is, right after marking: the fraction of pages
+ * with something alive in them that compaction would free up. A page that's
+ * completely dead doesn't count - the sweeper recycles those for free.
+ */
+double heapFragmentation() {
+    long live[NUM_OBJECT_TYPES] = {0};
+    long occupied = 0;
+    for (int p = 0; p < numPages; p++) {
+        int marked = countMarks(pages[p]);
+        if (marked == 0) continue;
+        live[pages[p]->type] += marked;
+        occupied++;
+    }
+    long needed = 0;
+    for (int t = 0; t < NUM_OBJECT_TYPES; t++) {
+        needed += (live[t] + SLOTS_PER_PAGE - 1) / SLOTS_PER_PAGE;
+    }
+    return occupied > 0 ? (double)(occupied - needed) / occupied : 0;
+}
+
+/**
+ * Where a marked object ends up once compaction has slid it down: the
+ * number of live objects in its space before it (its rank) picks the page
+ * and slot. The rank comes from compactRanks, which counts the live objects
+ * before each mark word, plus a popcount of the bits before it in its own
+ * word - so there's no forwarding pointer stored anywhere.
+ */
+static inline Object* compactForward(Object* object) {
+    if (!isHeapObject(object)) return object;
+    Page* page = pageOf(object);
+    int index = (int)(object - pageSlots(page));
+    int w = index >> 6;
+    uint64_t before = ((uint64_t)1 << (index & 63)) - 1;
+    int rank = compactRanks[page->compactIndex * MARK_WORDS + w] +
+               __builtin_popcountll(markedBits(page, w) & before);
+    return pageSlots(compactPages[page->type][rank / SLOTS_PER_PAGE]) +
+           rank % SLOTS_PER_PAGE;
+}
+
+/**
+ * Sliding compaction, in place of a sweep (straight after marking).
+ *
+ * Each space's pages are lined up in heap order, and every live object
+ * slides down to the lowest free slot, keeping its order. This is done in
+ * three passes, all driven by the mark bitmaps:
+ *
+ *  1. Count: fill compactRanks with the rank of each mark word's first
+ *     object, so compactForward() can find anyone's new address.
+ *  2. Fix up: point the stack and every live pair at the new addresses
+ *     (while everything is still in its old place).
+ *  3. Slide: copy each live object to its new slot. Its new slot is never
+ *     after its old one, so going in order never overwrites anything we
+ *     haven't moved yet.
+ *
+ * Afterwards every space is full pages followed by at most one partly
+ * used page with a bump region, and the pages left over go back to the
+ * system.
+ */
+void compact() {
+    for (int t = 0; t < NUM_OBJECT_TYPES; t++) compactCount[t] = 0;
+    for (int p = 0; p < numPages; p++) {
+        Page* page = pages[p];
+        addPageTo(&compactPages[page->type], &compactCount[page->type],
+                  &compactCapacity[page->type], page);
+    }
+    if (compactRanksCapacity < numPages * (int)MARK_WORDS) {
+        compactRanksCapacity = pageCapacity * MARK_WORDS;
+        compactRanks = realloc(compactRanks,
+                               compactRanksCapacity * sizeof(int));
+        if (compactRanks == NULL) {
+            printf("Out of memory!\n");
+            exit(1);
+        }
+    }
+
+    // 1. Count
+    int row = 0;
+    for (int t = 0; t < NUM_OBJECT_TYPES; t++) {
+        int rank = 0;
+        for (int i = 0; i < compactCount[t]; i++) {
+            Page* page = compactPages[t][i];
+            page->compactIndex = row;
+            for (int w = 0; w < (int)MARK_WORDS; w++) {
+                compactRanks[row * MARK_WORDS + w] = rank;
+                rank += __builtin_popcountll(markedBits(page, w));
+            }
+            row++;
+        }
+    }
+
+    // 2. Fix up
+    for (int i = 0; i < stackSize; i++) {
+        stack[i] = compactForward(stack[i]);
+    }
+    for (int i = 0; i < compactCount[OBJ_PAIR]; i++) {
+        Page* page = compactPages[OBJ_PAIR][i];
+        Object* slots = pageSlots(page);
+        for (int w = 0; w < (int)MARK_WORDS; w++) {
+            uint64_t bits = markedBits(page, w);
+            while (bits) {
+                Object* pair = &slots[w * 64 + __builtin_ctzll(bits)];
+                bits &= bits - 1;
+                pair->head = compactForward(pair->head);
+                pair->tail = compactForward(pair->tail);
+            }
+        }
+    }
+
+    // 3. Slide
+    long live = 0;
+    int kept = 0;
+    emptyPages = NULL;
+    for (int t = 0; t < NUM_OBJECT_TYPES; t++) {
+        int next = 0;
+        for (int i = 0; i < compactCount[t]; i++) {
+            Page* page = compactPages[t][i];
+            Object* slots = pageSlots(page);
+            for (int w = 0; w < (int)MARK_WORDS; w++) {
+                uint64_t bits = markedBits(page, w);
+                while (bits) {
+                    Object* from = &slots[w * 64 + __builtin_ctzll(bits)];
+                    bits &= bits - 1;
+                    Object* to =
+                        pageSlots(compactPages[t][next / SLOTS_PER_PAGE]) +
+                        next % SLOTS_PER_PAGE;
+                    if (to != from) *to = *from;
+                    next++;
+                }
+            }
+        }
+
+        int used = (next + SLOTS_PER_PAGE - 1) / SLOTS_PER_PAGE;
+        spaces[t].availPages = NULL;
+        spaces[t].liveObjects = next;
+        spaces[t].pagesSwept = used;
+        for (int i = 0; i < compactCount[t]; i++) {
+            Page* page = compactPages[t][i];
+            if (i >= used) {
+                free(page);
+                pagesReturned++;
+                continue;
+            }
+            page->bump = i < used - 1 ? SLOTS_PER_PAGE
+                                      : next - i * SLOTS_PER_PAGE;
+            page->freeList = NULL;
+            page->holes = 0;
+            page->holeLimit = 0;
+            page->inAvailList = 0;
+            resetMarkBits(page);
+            if (pageHasRoom(page)) makeAvailable(page);
+            pages[kept++] = page;
+        }
+        live += next;
+    }
+    numPages = kept;
+    numObjects = (int)live;
+    lazySweepNext = lazySweepEnd = 0; // Nothing's left to sweep
+    compactions++;
+}
+
+/**
+ * Gets rid of everything the mark left white. With generational on,
+ * sweeping also ages and promotes the young survivors, and the sweep is
+ * always eager. Without it, a heap that has got at least compactThreshold
+ * fragmented gets compacted instead of swept. Immix always sweeps eagerly,
+ * by lines.
+ */
+static void reclaim() {
+    for (int t = 0; t < NUM_OBJECT_TYPES; t++) {
+        spaces[t].liveObjects = 0;
+        spaces[t].pagesSwept = 0;
+    }
+    youngSurvived = 0;
+    if (compactThreshold > 0 && collector == COLLECTOR_MARK_SWEEP &&
+        !generational && heapFragmentation() >= compactThreshold) {
+        compact();
+    } else if (sweepMode == SWEEP_EAGER || generational ||
+               collector == COLLECTOR_IMMIX) {
+        sweep();
+    } else {
+        startLazySweep();
+        if (sweepMode == SWEEP_CONCURRENT) startBackgroundSweep();
+    }
+}
+
+/**
+ * Sets maxObjects for the next cycle from the live set (numObjects, right
+ * after a collection), going by growthPolicy. See GrowthPolicy.
+ */
+void resizeHeap() {
+    int live = numObjects;
+    long limit = maxObjects;
+    const char* why = "";
+    switch (growthPolicy) {
+    case GROWTH_FACTOR:
+        limit = (long)(live * growthFactor);
+        break;
+    case GROWTH_GOGC:
+        limit = live + (long)live * gogcPercent / 100;
+        break;
+    case GROWTH_LIVE_RATIO: {
+        double ratio = maxObjects > 0 ? (double)live / maxObjects : 1;
+        if (ratio < targetLiveRatio - LIVE_RATIO_SLACK ||
+            ratio > targetLiveRatio + LIVE_RATIO_SLACK) {
+            limit = (long)(live / targetLiveRatio);
+        } else {
+            why = " (kept)";
+        }
+        break;
+    }
+    case GROWTH_MAX_HEAP:
+        if (live >= maxHeapObjects) {
+            printf("Out of memory! %d objects live, the heap is capped at"
+                   " %d\n", live, maxHeapObjects);
+            exit(1);
+        }
+        limit = (long)(live * growthFactor);
+        break;
+    }
+    if (limit <= live) limit = live + 1; // Always room for one more
+    if (limit < minHeapObjects) {
+        limit = minHeapObjects;
+        why = " (minimum)";
+    }
+    if (growthPolicy == GROWTH_MAX_HEAP && limit > maxHeapObjects) {
+        limit = maxHeapObjects;
+        why = " (capped)";
+    }
+    if (limit > INT_MAX) limit = INT_MAX;
+    maxObjects = (int)limit;
+
+    if (heapLog) {
+        const char* names[] = {"factor", "gogc", "live ratio", "max heap"};
+        printf("Heap Policy (%s): Live %d | Next GC at %d%s\n",
+               names[growthPolicy], live, maxObjects, why);
+    }
+}
+
+/**
+ * A full collection: clears every mark, marks the whole heap and then
+ * reclaims the garbage (see reclaim()). The Immix collector marks with
+ * immixMarkAll().
+ */
+void fullGc() {
+    int prevCount = numObjects;
+    
+    // Start Timer
+    double start = nowSeconds();
+
+    stopBackgroundSweep();
+    retireAllocBuffer();
+    clearMarks();
+    if (collector == COLLECTOR_IMMIX) {
+        immixMarkAll();
+        retireAllocBuffer(); // Hand back the pages we evacuated into
+    } else {
+        markAll();
+    }
+    reclaim();
+
+    // Stop Timer
+    double time_spent = nowSeconds() - start;
+    lastGcPause = time_spent;
+    fullCollections++;
+
+    if (generational) {
+        finishNursery(0);
+        fullGcThreshold = numObjects * 2 > nurserySize ? numObjects * 2
+                                                       : nurserySize;
+    }
+
+    // Only print if we actually collected something or if it took
+    // measurable time
+    // This reduces spam during the big tests
+    if (gcLog && prevCount - numObjects > 0) {
+        printf("GC Run: Collected %d | Remaining %d | Time: %f sec\n", 
+               prevCount - numObjects, numObjects, time_spent);
+    }
+    if (!generational) resizeHeap(); // finishNursery() set the limit
+}
+
+/**
+ * The marker thread's version of mark(): an atomic bit flip, counted in
+ * its own tally, since the mutator is marking (and counting) too.
+ */
+static inline void markConcurrent(Object* object, long* marked) {
+    if (!isHeapObject(object) || testAndSetMarkAtomic(object)) return;
+    (*marked)++;
+    if (objectType(object) == OBJ_PAIR) pushMark(object);
+}
+
+/**
+ * The marker thread.
+ *
+ * It sleeps until an incremental mark starts, then drains the mark stack,
+ * reading each pair's fields atomically (the mutator may be storing to
+ * them). When the stack runs dry it takes whatever the mutator has handed
+ * over in markerQueue, and if that's empty too it says it's idle and waits
+ * for more. It parks again when the mutator asks it to stop. A mark stack
+ * overflow is left for the final pause, which can walk the heap safely.
+ */
+static void* markerMain(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&markerLock);
+    for (;;) {
+        while (!markerBusy) pthread_cond_wait(&markerWake, &markerLock);
+        pthread_mutex_unlock(&markerLock);
+
+        long marked = 0;
+        while (!__atomic_load_n(&markerStop, __ATOMIC_ACQUIRE)) {
+            if (markStack.count > 0) {
+                Object* pair = markStack.items[--markStack.count];
+                markConcurrent(__atomic_load_n(&pair->head, __ATOMIC_RELAXED),
+                               &marked);
+                markConcurrent(__atomic_load_n(&pair->tail, __ATOMIC_RELAXED),
+                               &marked);
+                continue;
+            }
+
+            pthread_mutex_lock(&markerLock);
+            while (markerQueueCount == 0 &&
+                   !__atomic_load_n(&markerStop, __ATOMIC_ACQUIRE)) {
+                __atomic_store_n(&markerIdle, 1, __ATOMIC_RELEASE);
+                pthread_cond_wait(&markerWake, &markerLock);
+            }
+            __atomic_store_n(&markerIdle, 0, __ATOMIC_RELEASE);
+            // Swap buffers, so the mutator can go on filling the other one
+            Object** taken = markerQueue;
+            int count = markerQueueCount;
+            int capacity = markerQueueCapacity;
+            markerQueue = markerTaken;
+            markerQueueCapacity = markerTakenCapacity;
+            markerQueueCount = 0;
+            markerTaken = taken;
+            markerTakenCapacity = capacity;
+            pthread_mutex_unlock(&markerLock);
+
+            for (int i = 0; i < count; i++) markConcurrent(taken[i], &marked);
+        }
+
+        pthread_mutex_lock(&markerLock);
+        markerMarked = marked;
+        markerBusy = 0;
+        pthread_cond_broadcast(&markerDone);
+    }
+    return NULL;
+}
+
+/**
+ * Sets the marker thread going on the current mark stack, starting the
+ * thread the first time we need it.
+ */
+static void startMarker() {
+    pthread_mutex_lock(&markerLock);
+    if (!markerStarted) {
+        pthread_create(&markerThread, NULL, markerMain, NULL);
+        markerStarted = 1;
+    }
+    __atomic_store_n(&markerIdle, 0, __ATOMIC_RELEASE);
+    markerBusy = 1;
+    pthread_cond_signal(&markerWake);
+    pthread_mutex_unlock(&markerLock);
+}
+
+/**
+ * Parks the marker thread and waits until it has. Whatever it hadn't got
+ * to is still on the mark stack and in markerQueue.
+ */
+static void stopMarker() {
+    if (!markerStarted) return;
+    pthread_mutex_lock(&markerLock);
+    __atomic_store_n(&markerStop, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&markerWake);
+    while (markerBusy) pthread_cond_wait(&markerDone, &markerLock);
+    __atomic_store_n(&markerStop, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&markerLock);
+    markedObjects += markerMarked;
+    concurrentMarked += markerMarked;
+    markerMarked = 0;
+}
+
+/**
+ * Starts an incremental mark: a fresh cycle with just the roots grey.
+ *
+ * Whatever a lazy sweep hadn't got to stays unswept until this cycle's
+ * sweep - sweeping it now, with half-finished marks, would free live
+ * objects. Leaf holes are given up for the same reason: clearMarks() just
+ * made every slot look free.
+ */
+void startIncrementalMark() {
+    double start = nowSeconds();
+    stopBackgroundSweep();
+    lazySweepNext = lazySweepEnd = 0;
+    retireAllocBuffer();
+    clearMarks();
+    for (int p = 0; p < numPages; p++) {
+        pages[p]->holes = 0;
+        pages[p]->holeLimit = 0;
+    }
+    for (int i = 0; i < stackSize; i++) {
+        mark(stack[i]);
+    }
+    // On the time grid, the next allocation looks for a quantum right away
+    markCredit = timeScheduled ? BEAT_CHECK_ALLOCS - 1 : 0;
+    markDeadline = numObjects * 2 > INITIAL_GC_THRESHOLD
+                       ? numObjects * 2
+                       : INITIAL_GC_THRESHOLD;
+    markingActive = 1;
+    if (concurrentMark) startMarker();
+    noteGcTime(start, nowSeconds());
+}
+
+/**
+ * Finishes an incremental mark and reclaims the garbage, in one pause.
+ *
+ * The barriers never see the stack, so the roots get marked again, and
+ * then we mark until the mark stack and the SATB log are both empty (the
+ * log can't grow - the mutator isn't running). With a marker thread, it's
+ * parked first and the log it hadn't taken yet gets marked too.
+ */
+void finishIncrementalMark() {
+    int prevCount = numObjects;
+    double start = nowSeconds();
+
+    if (concurrentMark) {
+        stopMarker();
+        for (int i = 0; i < markerQueueCount; i++) mark(markerQueue[i]);
+        markerQueueCount = 0;
+    }
+    retireAllocBuffer();
+    for (int i = 0; i < stackSize; i++) {
+        mark(stack[i]);
+    }
+    for (;;) {
+        while (satbCount > 0) mark(satbLog[--satbCount]);
+        processMarkStack();
+        if (markStack.overflowed) rescanHeap();
+        else if (satbCount == 0) break;
+    }
+    markingActive = 0;
+    reclaim();
+
+    double time_spent = nowSeconds() - start;
+    lastGcPause = time_spent;
+    fullCollections++;
+    noteGcTime(start, start + time_spent);
+
+    if (gcLog && prevCount - numObjects > 0) {
+        printf("Incremental GC: Collected %d | Remaining %d | Time: %f sec\n",
+               prevCount - numObjects, numObjects, time_spent);
+    }
+    resizeHeap();
+}
+
+/**
+ * Takes a beat for the collector if the grid has room for it: with it, the
+ * last gcWindowMicros of beats may hold at most gcBeatCount collector
+ * beats. gcBeats is a ring of the last gcBeatCount beats taken, so the
+ * one about to be overwritten is the oldest, and it has to have dropped
+ * out of the window.
+ */
+static int takeBeat(long beat) {
+    long window = gcWindowMicros / gcQuantumMicros;
+    long newest = gcBeats[(gcBeatNext + gcBeatCount - 1) % gcBeatCount];
+    if (beat == newest || beat - gcBeats[gcBeatNext] < window) return 0;
+    gcBeats[gcBeatNext] = beat;
+    gcBeatNext = (gcBeatNext + 1) % gcBeatCount;
+    return 1;
+}
+
+/**
+ * Remembers that the collector ran from start to end, if anyone asked
+ * (recordGcTimes). Runs that touch are merged, so a step that ended in
+ * finishIncrementalMark() shows up as one interval.
+ */
+void noteGcTime(double start, double end) {
+    if (!recordGcTimes) return;
+    if (numGcTimes > 0 && start <= gcTimes[numGcTimes - 1].end) {
+        GcInterval* last = &gcTimes[numGcTimes - 1];
+        if (start < last->start) last->start = start;
+        if (end > last->end) last->end = end;
+        return;
+    }
+    if (numGcTimes == gcTimesCapacity) {
+        gcTimesCapacity = gcTimesCapacity ? gcTimesCapacity * 2 : 1024;
+        gcTimes = realloc(gcTimes, gcTimesCapacity * sizeof(GcInterval));
+        if (gcTimes == NULL) {
+            printf("Out of memory!\n");
+            exit(1);
+        }
+    }
+    gcTimes[numGcTimes++] = (GcInterval){start, end};
+}
+
+/**
+ * One bit of incremental marking, paid for by an allocation.
+ *
+ * Each allocation earns markWorkRatio units of credit, and once there's
+ * MARK_STEP_WORK of it we spend it all: each unit scans one grey pair or
+ * marks one logged pointer. A step that runs past markStepMicros stops
+ * early and lets the rest of its credit go, so no step is ever longer than
+ * the budget (plus one check interval). If the heap doubles before we're
+ * done, the rest of the mark happens in finishIncrementalMark()'s pause.
+ * With a marker thread there's nothing to do here but notice it's idle.
+ *
+ * With timeScheduled it's the clock that pays instead: every
+ * BEAT_CHECK_ALLOCS allocations we see which beat we're in, and if
+ * takeBeat() lets us have it we mark until the beat is over.
+ */
+void markStep() {
+    if (numObjects >= markDeadline) {
+        markOverruns++;
+        finishIncrementalMark();
+        return;
+    }
+    if (concurrentMark) {
+        if (__atomic_load_n(&markerIdle, __ATOMIC_ACQUIRE)) {
+            finishIncrementalMark();
+        }
+        return;
+    }
+
+    double start;
+    double until; // When to stop (0 = only when the work runs out)
+    int work;
+    if (timeScheduled) {
+        if (++markCredit < BEAT_CHECK_ALLOCS) return;
+        markCredit = 0;
+        start = nowSeconds();
+        long beat = (long)(start * 1e6 / gcQuantumMicros);
+        if (!takeBeat(beat)) return;
+        until = (beat + 1) * gcQuantumMicros / 1e6;
+        work = INT_MAX;
+    } else {
+        markCredit += markWorkRatio;
+        if (markCredit < MARK_STEP_WORK) return;
+        start = nowSeconds();
+        until = markStepMicros > 0 ? start + markStepMicros / 1e6 : 0;
+        work = markCredit;
+        markCredit = 0;
+    }
+    for (int done = 0; done < work; done++) {
+        if (markStack.count > 0) {
+            Object* pair = markStack.items[--markStack.count];
+            mark(pair->head);
+            mark(pair->tail);
+        } else if (satbCount > 0) {
+            mark(satbLog[--satbCount]);
+        } else {
+            break;
+        }
+        if (until > 0 && (done & 31) == 31 && nowSeconds() > until) break;
+    }
+    double step = nowSeconds() - start;
+    if (step > longestMarkStep) longestMarkStep = step;
+    markSteps++;
+
+    if (markStack.count == 0 && satbCount == 0) finishIncrementalMark();
+    noteGcTime(start, nowSeconds());
+}
+
+/**
+ * Turns time-based scheduling on or off, with whatever gcQuantumMicros,
+ * gcWindowMicros and targetMmu are set to (so set those first). It's
+ * incremental marking underneath, so that gets turned on too. A targetMmu
+ * that doesn't leave room for one quantum per window would never let the
+ * collector run, so that's an error.
+ */
+void setTimeScheduled(int on) {
+    timeScheduled = on;
+    if (!on) return;
+    setIncremental(1);
+    if (gcQuantumMicros < 1 || gcWindowMicros < gcQuantumMicros) {
+        printf("The GC window has to be at least one quantum long!\n");
+        exit(1);
+    }
+    gcBeatCount = (int)((1 - targetMmu) * gcWindowMicros / gcQuantumMicros);
+    if (gcBeatCount < 1) {
+        printf("An MMU of %.2f leaves no room for a %dus quantum in %dus!\n",
+               targetMmu, gcQuantumMicros, gcWindowMicros);
+        exit(1);
+    }
+    free(gcBeats);
+    gcBeats = malloc(gcBeatCount * sizeof(long));
+    if (gcBeats == NULL) {
+        printf("Out of memory!\n");
+        exit(1);
+    }
+    for (int i = 0; i < gcBeatCount; i++) gcBeats[i] = LONG_MIN / 2;
+    gcBeatNext = 0;
+}
+
+/**
+ * How much of the collector's time falls between a and b. gcTimes is in
+ * order and nothing in it overlaps, so a binary search finds the first
+ * interval that could count.
+ */
+static double gcTimeBetween(double a, double b) {
+    int lo = 0;
+    int hi = numGcTimes;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (gcTimes[mid].end <= a) lo = mid + 1;
+        else hi = mid;
+    }
+    double total = 0;
+    for (int i = lo; i < numGcTimes && gcTimes[i].start < b; i++) {
+        double from = gcTimes[i].start > a ? gcTimes[i].start : a;
+        double to = gcTimes[i].end < b ? gcTimes[i].end : b;
+        total += to - from;
+    }
+    return total;
+}
+
+/**
+ * Minimum mutator utilization: the smallest share of any 'window' seconds
+ * between from and to that the collector wasn't running in (going by
+ * gcTimes, so recordGcTimes has to have been on). Sliding a window never
+ * makes it worse until it starts where the collector starts or ends where
+ * it stops, so those are the only windows we need to try.
+ */
+double minimumMutatorUtilization(double from, double to, double window) {
+    if (to - from < window) window = to - from;
+    double worst = gcTimeBetween(from, from + window);
+    for (int i = 0; i < numGcTimes; i++) {
+        double a = gcTimes[i].start;
+        if (a + window > to) a = to - window;
+        double b = gcTimes[i].end - window;
+        if (b < from) b = from;
+        double gcA = gcTimeBetween(a, a + window);
+        double gcB = gcTimeBetween(b, b + window);
+        if (gcA > worst) worst = gcA;
+        if (gcB > worst) worst = gcB;
+    }
+    return worst >= window ? 0 : 1 - worst / window;
+}
+
+/**
+ * Turns incremental marking on or off. Only safe between cycles (right
+ * after resetVM(), say). Without a marking barrier the mutator could hide
+ * objects from the marker, so one has to be compiled in.
+ */
+void setIncremental(int on) {
+    if (on && !(WRITE_BARRIER & (BARRIER_SATB | BARRIER_DIJKSTRA))) {
+        printf("Incremental marking needs BARRIER_SATB or BARRIER_DIJKSTRA"
+               " in WRITE_BARRIER!\n");
+        exit(1);
+    }
+    incrementalMark = on;
+}
+
+/**
+ * Copies an object into to-space (unless it's been copied already) and
+ * returns where it lives now. The copy is bump-allocated like any other
+ * object; if its type needs a new to-space page, pair pages also join the
+ * scan queue, in order.
+ */
+static Object* evacuate(Object* object) {
+    if (!isHeapObject(object)) return object;
+    if (testAndSetMark(object)) return object->head; // Forwarding pointer
+
+    ObjectType type = objectType(object);
+    AllocBuffer* tlab = &tlabs[type];
+    if (tlab->cursor == tlab->limit) {
+        refillAllocBuffer(type);
+        if (type == OBJ_PAIR) {
+            addPageTo(&scanQueue, &scanQueueCount, &scanQueueCapacity,
+                      tlab->page);
+        }
+    }
+    Object* copy = tlab->cursor++;
+    *copy = *object;
+    object->head = copy;
+    return copy;
+}
+
+/**
+ * A copying collection (Cheney's algorithm).
+ *
+ * The roots are copied first, then a scan pointer walks the copied pairs in
+ * to-space in the order they were copied, copying their children to the end
+ * of to-space as it goes. When the scan pointer catches up with the
+ * allocation pointer, everything alive has been copied and everything else
+ * is just left behind in from-space.
+ *
+ * Then the from-space pages are emptied and join the empty page pool, the
+ * same place the sweeper puts pages where nothing survived. That's where
+ * the mutator and the next to-space get their pages from.
+ */
+void copyGc() {
+    int prevCount = numObjects;
+    double start = nowSeconds();
+
+    retireAllocBuffer();
+    clearMarks();
+
+    // Pages with objects in them are from-space; empty ones are to-space
+    if (fromSpaceCapacity < numPages) {
+        fromSpaceCapacity = pageCapacity;
+        fromSpace = realloc(fromSpace, fromSpaceCapacity * sizeof(Page*));
+        if (fromSpace == NULL) {
+            printf("Out of memory!\n");
+            exit(1);
+        }
+    }
+    int numFrom = 0;
+    int kept = 0;
+    for (int i = 0; i < numPages; i++) {
+        Page* page = pages[i];
+        if (page->inAvailList && page->bump == 0) pages[kept++] = page;
+        else fromSpace[numFrom++] = page;
+    }
+    numPages = kept;
+    for (int t = 0; t < NUM_OBJECT_TYPES; t++) spaces[t].availPages = NULL;
+
+    scanQueueCount = 0;
+    for (int i = 0; i < stackSize; i++) {
+        stack[i] = evacuate(stack[i]);
+    }
+    AllocBuffer* pairBuffer = &tlabs[OBJ_PAIR];
+    for (int q = 0; q < scanQueueCount; q++) {
+        Object* scan = pageSlots(scanQueue[q]);
+        // The page being copied into only goes as far as the bump pointer,
+        // which keeps moving while we scan
+        while (scan < (scanQueue[q] == pairBuffer->page
+                           ? pairBuffer->cursor
+                           : pageSlots(scanQueue[q]) + SLOTS_PER_PAGE)) {
+            scan->head = evacuate(scan->head);
+            scan->tail = evacuate(scan->tail);
+            scan++;
+        }
+    }
+    numObjects = (int)markedObjects;
+
+    // Empty from-space. The mark bits can stay as they are: nothing looks
+    // at them until the next clearMarks() tidies up every stale page
+    for (int i = 0; i < numFrom; i++) {
+        Page* page = fromSpace[i];
+        page->freeList = NULL;
+        page->bump = 0;
+        page->holes = 0;
+        page->holeLimit = 0;
+        page->inAvailList = 0;
+        makeAvailable(page);
+        addPageTo(&pages, &numPages, &pageCapacity, page);
+    }
+
+    double time_spent = nowSeconds() - start;
+    lastGcPause = time_spent;
+    fullCollections++;
+
+    if (gcLog && prevCount - numObjects > 0) {
+        printf("Copy GC: Collected %d | Remaining %d | Time: %f sec\n",
+               prevCount - numObjects, numObjects, time_spent);
+    }
+    resizeHeap();
+}
+
+/**
+ * Finds the treadmill links of an object, and the object a link belongs
+ * to. They're at the same offset in the page and its link page.
+ */
+static inline TreadmillLink* linkOf(Object* object) {
+    Page* page = pageOf(object);
+    return (TreadmillLink*)((char*)page->links +
+                            ((uintptr_t)object & (PAGE_SIZE - 1)));
+}
+
+static inline Object* objectOf(TreadmillLink* link) {
+    uintptr_t offset = (uintptr_t)link & (PAGE_SIZE - 1);
+    Page* page = *(Page**)((uintptr_t)link - offset);
+    return (Object*)((char*)page + offset);
+}
+
+static inline void unlinkCell(TreadmillLink* link) {
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+}
+
+static inline void insertBefore(TreadmillLink* link, TreadmillLink* at) {
+    link->prev = at->prev;
+    link->next = at;
+    at->prev->next = link;
+    at->prev = link;
+}
+
+/**
+ * Empties both treadmills: just the four sentinels, in order, in a circle.
+ */
+void resetTreadmills() {
+    for (int t = 0; t < NUM_OBJECT_TYPES; t++) {
+        Treadmill* ring = &treadmills[t];
+        for (int i = 0; i < 4; i++) {
+            ring->sentinels[i].next = &ring->sentinels[(i + 1) % 4];
+            ring->sentinels[i].prev = &ring->sentinels[(i + 3) % 4];
+        }
+        ring->blackS = &ring->sentinels[0];
+        ring->greyS = &ring->sentinels[1];
+        ring->whiteS = &ring->sentinels[2];
+        ring->freeS = &ring->sentinels[3];
+        ring->black = ring->grey = ring->white = ring->free = 0;
+    }
+}
+
+/**
+ * Shades an object: if it's white, it moves to the end of the grey
+ * segment, or, for a leaf, straight to the end of the black one.
+ */
+static void treadmillShade(Object* object) {
+    if (!isHeapObject(object) || testAndSetMark(object)) return;
+    TreadmillLink* link = linkOf(object);
+    Treadmill* ring = &treadmills[objectType(object)];
+    unlinkCell(link);
+    ring->white--;
+    if (objectType(object) == OBJ_PAIR) {
+        insertBefore(link, ring->whiteS);
+        ring->grey++;
+    } else {
+        insertBefore(link, ring->greyS);
+        ring->black++;
+    }
+}
+
+/**
+ * Does up to 'work' units of marking: each one scans the first grey pair
+ * (and moves it to black) or shades one pointer from the SATB log. Returns
+ * the number of units left over, so anything above 0 means nothing's left.
+ */
+static int treadmillMark(int work) {
+    Treadmill* ring = &treadmills[OBJ_PAIR];
+    for (; work > 0; work--) {
+        if (ring->grey > 0) {
+            TreadmillLink* link = ring->greyS->next;
+            Object* pair = objectOf(link);
+            treadmillShade(pair->head);
+            treadmillShade(pair->tail);
+            unlinkCell(link);
+            insertBefore(link, ring->greyS);
+            ring->grey--;
+            ring->black++;
+        } else if (satbCount > 0) {
+            treadmillShade(satbLog[--satbCount]);
+        } else {
+            break;
+        }
+    }
+    return work;
+}
+
+/**
+ * True once the mark is done. The barriers don't see the stack, so the
+ * roots get shaded again first (with SATB that never finds anything new,
+ * but the Dijkstra barrier needs it).
+ */
+static int treadmillMarkDone() {
+    if (treadmills[OBJ_PAIR].grey > 0 || satbCount > 0) return 0;
+    for (int i = 0; i < stackSize; i++) {
+        treadmillShade(stack[i]);
+    }
+    return treadmills[OBJ_PAIR].grey == 0;
+}
+
+/**
+ * The flip, once the mark is done. In each ring the white cells become
+ * free, the black ones become white, and the grey and black segments start
+ * out empty, by moving two sentinels and renaming all four:
+ *
+ *   blackS B.. greyS whiteS W.. freeS F..
+ *   -> blackS' greyS' whiteS' B.. freeS' W.. F..
+ *
+ * Flipping markSense makes every black cell's bit read white. Then the
+ * roots are shaded, and the next cycle has begun. Like after any other
+ * collection, the next flip waits until the heap has doubled.
+ */
+void treadmillFlip() {
+    int prevCount = numObjects;
+    double start = nowSeconds();
+
+    for (int t = 0; t < NUM_OBJECT_TYPES; t++) {
+        Treadmill* ring = &treadmills[t];
+        TreadmillLink* black = ring->whiteS;
+        TreadmillLink* grey = ring->freeS;
+        TreadmillLink* white = ring->blackS;
+        TreadmillLink* freeS = ring->greyS;
+        unlinkCell(black);
+        unlinkCell(grey);
+        insertBefore(black, white);
+        insertBefore(grey, white);
+        ring->blackS = black;
+        ring->greyS = grey;
+        ring->whiteS = white;
+        ring->freeS = freeS;
+
+        numObjects -= ring->white;
+        ring->free += ring->white;
+        ring->white = ring->black;
+        ring->black = 0;
+    }
+    markSense ^= 1;
+    markEpoch++;
+    markingActive = 1;
+    for (int i = 0; i < stackSize; i++) {
+        treadmillShade(stack[i]);
+    }
+
+    double time_spent = nowSeconds() - start;
+    lastGcPause = time_spent;
+    fullCollections++;
+
+    if (gcLog && prevCount - numObjects > 0) {
+        printf("Treadmill Flip: Collected %d | Remaining %d | Time: %f sec\n",
+               prevCount - numObjects, numObjects, time_spent);
+    }
+    resizeHeap();
+}
+
+/**
+ * Gives a treadmill a new page: a link page to go with it, and every slot
+ * on the free segment, in address order.
+ */
+static void treadmillGrow(ObjectType type) {
+    Treadmill* ring = &treadmills[type];
+    Page* page = newPage(type);
+    page->bump = SLOTS_PER_PAGE; // Nothing else allocates from it
+    page->links = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+    if (page->links == NULL) {
+        printf("Out of memory!\n");
+        exit(1);
+    }
+    *(Page**)page->links = page;
+    Object* slots = pageSlots(page);
+    for (int i = 0; i < SLOTS_PER_PAGE; i++) {
+        insertBefore(linkOf(&slots[i]), ring->blackS);
+    }
+    ring->free += SLOTS_PER_PAGE;
+}
+
+/**
+ * Allocation on the treadmill. First markWorkRatio units of marking, then
+ * the first free cell moves over to become the first black cell.
+ * When the free cells have run out we flip if the mark is done and the
+ * heap has reached maxObjects, and grow otherwise (or if nothing got
+ * freed), so the GC work any one allocation does is bounded by the rate,
+ * the roots and one page.
+ */
+Object* treadmillAlloc(ObjectType type) {
+    Treadmill* ring = &treadmills[type];
+    treadmillMark(markWorkRatio);
+    if (ring->free == 0) {
+        if (numObjects >= maxObjects && treadmillMarkDone()) treadmillFlip();
+        if (ring->free == 0) treadmillGrow(type);
+    }
+
+    TreadmillLink* link = ring->freeS->next;
+    unlinkCell(link);
+    insertBefore(link, ring->blackS->next);
+    ring->free--;
+    ring->black++;
+
+    Object* object = objectOf(link);
+    testAndSetMark(object); // Born black
+    numObjects++;
+    return object;
+}
+
+/**
+ * gc() on the treadmill: finishes the mark and flips, twice. The first
+ * flip frees what was garbage when this cycle started; everything that
+ * died since (or was allocated black and dropped) is white after that,
+ * and the second flip frees it too.
+ */
+void treadmillCollect() {
+    for (int round = 0; round < 2; round++) {
+        while (!treadmillMarkDone()) treadmillMark(INT_MAX);
+        treadmillFlip();
+    }
+}
+
+/**
+ * Runs the garbage collector - this is where the magic happens!
+ * 
+ * First we mark everything we're still using, then we sweep away the garbage
+ * (or, with lazy or concurrent sweeping, leave it for the allocator and the
+ * sweeper thread). After cleaning up, we adjust our limit (double what's
+ * left) so we don't have to run this too often. Also prints out what
+ * happened so we can see it working. With generational on, most runs are
+ * minor collections of just the nursery instead (see minorGc()), and with
+ * the copying collector it's copyGc() every time. An incremental mark that's
+ * still running is thrown away: it started from an older snapshot and could
+ * keep objects that are garbage by now. The treadmill never stops marking,
+ * so there gc() just runs it to the end.
+ */
+void gc() {
+    if (collector == COLLECTOR_TREADMILL) {
+        treadmillCollect();
+        return;
+    }
+    if (markingActive) {
+        stopMarker();
+        markerQueueCount = 0;
+        markingActive = 0;
+        markStack.count = 0;
+        markStack.overflowed = 0;
+        satbCount = 0;
+    }
+    markDeferred = 0;
+
+    if (collector == COLLECTOR_COPYING) {
+        copyGc();
+        return;
+    }
+
+    // With generational on, collect just the nursery until the old
+    // generation has doubled since the last full collection
+    if (generational && lastGcObjects - youngObjects < fullGcThreshold) {
+        minorGc();
+        return;
+    }
+    fullGc();
+}
+
+/**
+ * Prints what the sweeper found out about each space since the last GC:
+ * how many pages it swept, how many objects survived in them, and how full
+ * that makes the space.
+ */
+void printSpaceStats() {
+    for (int t = 0; t < NUM_OBJECT_TYPES; t++) {
+        // The background sweeper may still be adding to these
+        long swept = __atomic_load_n(&spaces[t].pagesSwept, __ATOMIC_RELAXED);
+        long live = __atomic_load_n(&spaces[t].liveObjects, __ATOMIC_RELAXED);
+        long slots = swept * SLOTS_PER_PAGE;
+        printf(" %-7s space: %ld pages, %ld live, %.1f%% occupied\n",
+               spaces[t].name, swept, live,
+               slots > 0 ? 100.0 * live / slots : 0.0);
+    }
+}
+
+/**
+ * Wipes everything clean so we can start fresh.
+ * 
+ * Between tests, we need to reset back to square one - empty stack, no objects,
+ * original limits. This way each test starts with a clean slate and doesn't
+ * interfere with the others.
+ */
+void resetVM() {
+    // Reset all VM state so tests don't interfere
+    stackSize = 0;
+    stopBackgroundSweep();
+    stopMarker();
+    freeAllPages();
+    lazySweepNext = lazySweepEnd = 0;
+    numObjects = 0;
+    maxObjects = INITIAL_GC_THRESHOLD;
+    youngObjects = lastGcObjects = 0;
+    fullGcThreshold = nurserySize;
+    resetTreadmills();
+    markingActive = 0;
+    markDeferred = 0;
+    satbCount = 0;
+    markerQueueCount = 0;
+    markStack.count = 0;
+    markStack.overflowed = 0;
+}
+
+/**
+ * Test 1: Make sure we don't delete stuff we're still using!
+ * 
+ * The most basic rule - if something's on the stack, DON'T collect it.
+ * We put two numbers on the stack, run GC, and both should still be there.
+ */
+void test1_ObjectsOnStack() {
+    printf("Test 1: Objects on stack should be preserved.\n");
+    resetVM();
+    pushInt(1);
+    pushInt(2);
+    gc();
+    
+}
+
+/**
+ * Test 2: Make sure we DO delete stuff we're not using anymore.
+ * 
+ * We create two objects, then immediately throw them away (pop them off).
+ * When GC runs, it should find them and clean them up.
+ */
+void test2_UnreachedObjects() {
+    printf("Test 2: Unreached objects should be collected.\n");
+    resetVM();
+    pushInt(1);
+    pushInt(2);
+    pop(); // Drop 2
+    pop(); // Drop 1
+    gc();
+}
+
+/**
+ * Test 3: Keep things we can reach indirectly.
+ * 
+ * We make a pair that contains two numbers. Even though the numbers aren't
+ * directly on the stack, we can reach them through the pair, so all three
+ * objects should stick around.
+ */
+void test3_Reachability() {
+    printf("Test 3: Reachability.\n");
+    resetVM();
+    pushInt(1);
+    pushInt(2);
+    pushPair(); // Pair holding 1 and 2
+    gc();
+}
+
+/**
+ * Test 4: Handle circular references (the cool part!).
+ * 
+ * We create two pairs that point to each other in a circle. Even though they
+ * reference each other, once we take them off the stack they're garbage.
+ * This is where mark-and-sweep shines - reference counting would leak this!
+ */
+void test4_Cycles() {
+    printf("Test 4: Cycles (The Mark-Sweep Advantage).\n");
+    resetVM();
+    // Create two pairs that reference each other
+    pushInt(1);
+    pushInt(2);
+    Object* a = pushPair(); // A points to 1 and 2
+    
+    pushInt(3);
+    pushInt(4);
+    Object* b = pushPair(); // B points to 3 and 4
+    
+    // Make them point to each other to create a cycle
+    setTail(a, b);
+    setTail(b, a);
+
+    // Remove both from stack
+    pop(); // Remove b
+    pop(); // Remove a
+    
+    // Mark-sweep handles cycles, reference counting would leak
+    gc();
+    
+}
+/**
+ * Test 5: Make sure GC kicks in automatically when needed.
+ * 
+ * Our limit starts at 8 objects. When we try to create 10, GC should trigger
+ * on its own at 8, clean up nothing (we're using everything), and grow the
+ * limit so we can fit all 10.
+ */
+void test5_HeapGrowth() {
+    printf("Test 5: Auto-trigger GC and Heap Growth.\n");
+    resetVM();
+    // maxObjects starts at 8
+    for (int i = 0; i < 10; i++) {
+        pushInt(i);
+    }
+    
+    
+}
+
+/**
+ * Test 6: Can we handle lots of rapid creation and deletion?
+ * 
+ * We create 1000 objects and immediately throw them all away in a loop.
+ * This tests if the GC can keep up with lots of temporary objects without
+ * leaking memory or getting confused.
+ */
+void test6_PerformanceChurn() {
+    printf("Test 6: Performance & Scalability.\n");
+    
+    // test 3 different sizes to show the "linear" time increase
+    int sizes[] = {1000, 10000, 50000};
+    
+    for (int s = 0; s < 3; s++) {
+        int size = sizes[s];
+        printf(" Running stress test with %d objects\n", size);
+        
+        resetVM();
+        // Set a high threshold so GC doesn't trigger automatically during
+        // creation
+        maxObjects = size * 2; 
+        
+        for (int i = 0; i < size; i++) {
+            pushInt(i);
+            pop(); // Immediately make it garbage
+        }
+        
+        // Manual trigger to measure the full sweep of 'size' garbage objects
+        gc(); 
+    }
+}
+
+/**
+ * Test 7: Can we handle really deep nested structures?
+ * 
+ * We build a linked list 20 layers deep (like a chain). This makes sure our
+ * recursive marking doesn't crash when following long chains of references.
+ * All 41 objects should survive.
+ */
+void test7_DeepRecursion() {
+    printf("Test 7: Deep Recursion.\n");
+    resetVM();
+    pushInt(0);
+    for (int i = 0; i < 20; i++) {
+        pushInt(i);
+        pushPair();
+    }
+    gc();
+    // 1 Int + 20 * (1 Int + 1 Pair) = 41 objects
+}
+
+/**
+ * Test 8: Delete some things but not others.
+ * 
+ * We create two objects but only throw away one. GC should be smart enough
+ * to delete the one we don't need anymore while keeping the other.
+ */
+void test8_PartialDelete() {
+    printf("Test 8: Partial Deletion.\n");
+    resetVM();
+    // Push 2, pop 1
+    pushInt(10);
+    pushInt(20);
+    pop(); // 20 becomes garbage
+    gc();
+   
+}
+
+/**
+ * Test 9: If we clear everything, GC should clean up everything.
+ * 
+ * We make some objects, then manually clear the entire stack. Now nothing's
+ * reachable, so GC should delete everything. Nuclear option!
+ */
+void test9_FullClear() {
+    printf("Test 9: Full Clear.\n");
+    resetVM();
+    pushInt(1);
+    pushInt(2);
+    pushPair();
+    // Clear entire stack
+    stackSize = 0;
+    gc();
+    
+}
+
+/**
+ * Test 10: After cleaning up, can we use the memory again?
+ * 
+ * Create something, delete it, then create something new. The new object
+ * should land in the exact slot the old one gave back. This confirms we're
+ * actually freeing memory properly and can reuse it.
+ */
+void test10_Reallocation() {
+    printf("Test 10: Reallocation Reuse.\n");
+    int savedImmediate = immediateInts;
+    immediateInts = 0; // An immediate int has no slot to reuse
+    resetVM();
+    Object* p1 = pushInt(1);
+    pop();
+    gc(); // Free the int
+    
+    Object* p2 = pushInt(2); // Should reuse p1's slot
+    printf(" Slot reused: %s\n", p1 == p2 ? "yes" : "no");
+    immediateInts = savedImmediate;
+}
+
+/**
+ * Test 11: A list way too long for recursive marking.
+ *
+ * We build a chain of 300,000 pairs. Marking this recursively would need
+ * hundreds of thousands of C stack frames and crash; with the mark stack it
+ * never needs more than a couple of entries. Everything should survive.
+ */
+void test11_LongList() {
+    printf("Test 11: Long List (Explicit Mark Stack).\n");
+    int savedImmediate = immediateInts;
+    immediateInts = 0;
+    resetVM();
+    int length = 300000;
+    pushInt(0);
+    for (int i = 0; i < length; i++) {
+        pushInt(i);
+        pushPair();
+    }
+    gc();
+    printf(" Survived %d objects (expected %d)\n", numObjects, 2 * length + 1);
+    immediateInts = savedImmediate;
+}
+
+/**
+ * Builds a perfectly balanced tree of pairs with integer leaves and leaves
+ * its root on the stack. A tree of depth d has 2^(d+1) - 1 objects.
+ */
+static void pushTree(int depth) {
+    if (depth == 0) {
+        pushInt(0);
+        return;
+    }
+    pushTree(depth - 1);
+    pushTree(depth - 1);
+    pushPair();
+}
+
+/**
+ * Test 12: What if the mark stack can't grow?
+ *
+ * We cap the mark stack at 4 entries and mark a bushy tree that needs far
+ * more than that. Marking should overflow, rescan the heap, and still find
+ * every object.
+ */
+void test12_MarkStackOverflow() {
+    printf("Test 12: Mark Stack Overflow.\n");
+    int savedImmediate = immediateInts;
+    immediateInts = 0;
+    resetVM();
+    pushTree(12);
+    markStackLimit = 4;
+    markRescans = 0;
+    gc();
+    printf(" Survived %d objects (expected %d) after %d rescans\n",
+           numObjects, (1 << 13) - 1, markRescans);
+    markStackLimit = 0;
+    immediateInts = savedImmediate;
+}
+
+/**
+ * Test 13: Parallel GC should find exactly what serial GC finds.
+ *
+ * We collect a forest of trees plus some garbage with 4 GC threads marking
+ * and sweeping. All the trees should survive and all the garbage should go,
+ * no matter how the workers end up splitting and stealing the work.
+ */
+void test13_ParallelMark() {
+    printf("Test 13: Parallel Mark and Sweep (4 threads).\n");
+    int savedWorkers = gcWorkers;
+    int savedImmediate = immediateInts;
+    setGcWorkers(4);
+    immediateInts = 0;
+    resetVM();
+    for (int i = 0; i < 16; i++) {
+        pushTree(8);
+        pushInt(i);
+        pop(); // Garbage between the trees
+    }
+    gc();
+    printf(" Survived %d objects (expected %d)\n", numObjects, 16 * 511);
+
+    // And again once everything's garbage, so the sweep has to empty pages
+    stackSize = 0;
+    if (generational) fullGc(); // The trees may be old by now
+    else gc();
+    printf(" After clearing the stack: %d objects left (expected 0)\n",
+           numObjects);
+    setGcWorkers(savedWorkers);
+    immediateInts = savedImmediate;
+}
+
+/**
+ * Test 14: Lazy sweeping should reclaim just as much as eager sweeping.
+ *
+ * We keep a tree alive and churn through lots of garbage with lazy sweeping
+ * on, so the GC only marks and the allocator does the sweeping as it needs
+ * room. The tree should survive, all the garbage should go, and the heap
+ * shouldn't keep growing because lazily swept pages get reused. Then we
+ * make the first allocation after a GC a pair: the sweep passes over a
+ * partly used integer page on the way, which must still be there for the
+ * integers that come next.
+ */
+void test14_LazySweep() {
+    printf("Test 14: Lazy Sweeping.\n");
+    SweepMode savedMode = sweepMode;
+    int savedImmediate = immediateInts;
+    Collector savedCollector = collector;
+    sweepMode = SWEEP_LAZY;
+    immediateInts = 0; // The churn has to make garbage
+    resetVM();
+    collector = COLLECTOR_MARK_SWEEP;
+    pagesSweptEager = pagesSweptLazy = 0;
+
+    pushTree(10);
+    maxObjects = 10000;
+    for (int i = 0; i < 30000; i++) {
+        pushInt(i);
+        pop(); // Immediately make it garbage
+    }
+    gc();
+    printf(" Survived %d objects (expected %d) in %d pages\n",
+           numObjects, (1 << 11) - 1, numPages);
+    printf(" Pages swept: %ld eagerly, %ld lazily\n",
+           pagesSweptEager, pagesSweptLazy);
+
+    resetVM();
+    maxObjects = 1 << 30; // We call gc() ourselves
+    for (int i = 0; i < 100; i++) pushInt(i);
+    stackSize = 50; // Leaves the integer page half empty
+    gc();
+    pushPair();
+    for (int i = 0; i < 10; i++) pushInt(i);
+    printf(" Pages after a pair and 10 integers: %d (expected 2)\n",
+           numPages);
+    sweepMode = savedMode;
+    immediateInts = savedImmediate;
+    collector = savedCollector;
+}
+
+/**
+ * Test 15: Background sweeping should reclaim just as much too.
+ *
+ * Same churn as test 14, but now a sweeper thread sweeps pages while we keep
+ * allocating. How the work splits between the allocator and the sweeper
+ * depends on timing, but the survivors shouldn't.
+ */
+void test15_ConcurrentSweep() {
+    printf("Test 15: Concurrent Sweeping.\n");
+    SweepMode savedMode = sweepMode;
+    int savedImmediate = immediateInts;
+    sweepMode = SWEEP_CONCURRENT;
+    immediateInts = 0; // The churn has to make garbage
+    resetVM();
+    pagesSweptEager = pagesSweptLazy = pagesSweptBackground = 0;
+
+    pushTree(10);
+    maxObjects = 10000;
+    for (int i = 0; i < 30000; i++) {
+        pushInt(i);
+        pop(); // Immediately make it garbage
+    }
+    gc();
+    stopBackgroundSweep(); // So the counters hold still
+    printf(" Survived %d objects (expected %d) in %d pages\n",
+           numObjects, (1 << 11) - 1, numPages);
+    printf(" Pages swept: %ld by the allocator, %ld in the background\n",
+           pagesSweptLazy, pagesSweptBackground);
+    sweepMode = savedMode;
+    immediateInts = savedImmediate;
+}
+
+/**
+ * Test 16: Flipping the mark sense should give the same answers as clearing.
+ *
+ * A heap where everything survives should barely touch its bitmaps from one
+ * cycle to the next. And with lazy sweeping, a second GC that comes along
+ * before the first one's pages were swept must still see them as unmarked.
+ */
+void test16_MarkEpochFlip() {
+    printf("Test 16: Mark Epoch Flip.\n");
+    SweepMode savedMode = sweepMode;
+    int savedImmediate = immediateInts;
+    sweepMode = SWEEP_EAGER;
+    immediateInts = 0;
+    resetVM();
+    pushTree(12);
+    gc();
+    long before = bitmapBytesWritten;
+    gc();
+    printf(" All-live heap: %ld bitmap bytes written (a clear writes %ld)\n",
+           bitmapBytesWritten - before,
+           (long)(numPages * sizeof(pages[0]->markBits)));
+
+    sweepMode = SWEEP_LAZY;
+    resetVM();
+    pushTree(10);
+    for (int i = 0; i < 5000; i++) {
+        pushInt(i);
+        pop(); // Garbage the lazy sweeper never gets to
+    }
+    gc();
+    gc(); // Nothing was swept in between
+    gc();
+    printf(" Survived %d objects (expected %d)\n", numObjects, (1 << 11) - 1);
+    pop();
+    if (generational) fullGc(); // The tree is old by now
+    else gc();
+    printf(" After dropping the tree: %d objects (expected 0)\n", numObjects);
+    sweepMode = savedMode;
+    immediateInts = savedImmediate;
+}
+
+/**
+ * Test 17: Immediate integers shouldn't need the heap at all.
+ *
+ * With immediateInts on, we churn through a pile of integers (no
+ * allocations, so no GC), then build a list of 1000 integers. Only the 1000
+ * pairs should end up on the heap, and walking the list should still give
+ * back every number - negative ones included.
+ */
+void test17_ImmediateInts() {
+    printf("Test 17: Immediate Integers.\n");
+    int savedImmediate = immediateInts;
+    immediateInts = 1;
+    resetVM();
+
+    for (int i = 0; i < 100000; i++) {
+        pushInt(i);
+        pop(); // Nothing to collect
+    }
+    printf(" Objects after churn: %d (expected 0)\n", numObjects);
+
+    int length = 1000;
+    pushInt(0);
+    for (int i = 0; i < length; i++) {
+        pushInt(i - length / 2);
+        pushPair();
+    }
+    gc();
+
+    long sum = 0;
+    int ints = 0;
+    for (Object* list = stack[0]; !isInt(list); list = list->head) {
+        sum += intValue(list->tail);
+        ints++;
+    }
+    printf(" Survived %d objects (expected %d), list sum %ld over %d ints"
+           " (expected %d over %d)\n", numObjects, length, sum, ints,
+           -length / 2, length);
+    immediateInts = savedImmediate;
+}
+
+/**
+ * Test 18: Leaf pages get their holes reused straight from the bitmap.
+ *
+ * We build a list of 1000 integers and throw away another integer between
+ * each pair of them, so the leaf page ends up full of holes. Allocating
+ * 1000 more integers should fill those holes (no new pages) without
+ * disturbing the integers that are still in the list.
+ */
+void test18_LeafSpace() {
+    printf("Test 18: Leaf and Pointer Spaces.\n");
+    int savedImmediate = immediateInts;
+    double savedThreshold = compactThreshold;
+    Collector savedCollector = collector;
+    immediateInts = 0;
+    compactThreshold = 0; // Compacting would take the holes away
+    resetVM();
+    collector = COLLECTOR_MARK_SWEEP; // Immix hands out lines, not holes
+    maxObjects = 1 << 30; // We call gc() ourselves
+
+    int length = 1000;
+    pushInt(0);
+    for (int i = 0; i < length; i++) {
+        pushInt(i);
+        pushInt(-1);
+        pop(); // A hole between every pair of survivors
+        pushPair();
+    }
+    gc();
+    printSpaceStats();
+
+    int before = numPages;
+    for (int i = 0; i < length; i++) {
+        pushInt(-1);
+        pop();
+    }
+    long sum = 0;
+    for (Object* list = stack[0]; !isInt(list); list = list->head) {
+        sum += intValue(list->tail);
+    }
+    printf(" Pages after refilling the holes: %d (expected %d), list sum %ld"
+           " (expected %d)\n", numPages, before, sum,
+           length * (length - 1) / 2);
+    gc();
+    printf(" Survived %d objects (expected %d)\n", numObjects, 2 * length + 1);
+    immediateInts = savedImmediate;
+    compactThreshold = savedThreshold;
+    resetVM();
+    collector = savedCollector;
+}
+
+/**
+ * Test 19: Generational collection.
+ *
+ * We build a list and let two minor GCs promote it. Then we hang a brand
+ * new pair off the old list with setTail() and drop our only other
+ * reference to it. A minor GC only sees it through the dirty card, so it
+ * must survive; the churn after that must be collected by minor GCs alone.
+ * The int the new pair replaced is old garbage, so only a full GC frees it.
+ * Once the new pair has been promoted too, no card should stay dirty.
+ */
+void test19_Generational() {
+    printf("Test 19: Generational Collection.\n");
+    if (!(WRITE_BARRIER & BARRIER_CARD)) {
+        printf(" Skipped (built without BARRIER_CARD)\n");
+        return;
+    }
+    int savedImmediate = immediateInts;
+    int savedGenerational = generational;
+    int savedNursery = nurserySize;
+    int savedAge = promotionAge;
+    Collector savedCollector = collector;
+    immediateInts = 0;
+    nurserySize = 4096;
+    promotionAge = 2; // The two minor GCs below promote the list
+    resetVM();
+    collector = COLLECTOR_MARK_SWEEP;
+    setGenerational(1);
+
+    int length = 100;
+    long promotedBefore = promotedObjects;
+    pushInt(0);
+    for (int i = 0; i < length; i++) {
+        pushInt(i);
+        pushPair();
+    }
+    minorGc();
+    minorGc();
+    int old = 2 * length + 1;
+    printf(" Promoted %ld objects (expected %d)\n",
+           promotedObjects - promotedBefore, old);
+
+    pushInt(7);
+    pushInt(8);
+    Object* young = pushPair();
+    setTail(stack[0], young); // Old pair -> young pair
+    pop();
+    printf(" Dirty pages after setTail: %d (expected 1)\n", numDirtyPages);
+
+    long minorBefore = minorCollections;
+    for (int i = 0; i < 10000; i++) {
+        pushInt(i);
+        pop();
+    }
+    minorGc();
+    printf(" Survived %d objects (expected %d) after %ld minor GCs,"
+           " young pair holds %d and %d\n", numObjects, old + 3,
+           minorCollections - minorBefore, intValue(young->head),
+           intValue(young->tail));
+
+    minorGc(); // Promotes the young pair
+    printf(" Dirty pages once it's old: %d (expected 0)\n", numDirtyPages);
+    fullGc();
+    printf(" Survived %d objects after a full GC (expected %d)\n",
+           numObjects, old + 2);
+
+    setGenerational(savedGenerational);
+    immediateInts = savedImmediate;
+    nurserySize = savedNursery;
+    promotionAge = savedAge;
+    resetVM();
+    collector = savedCollector;
+}
+
+/**
+ * Test 20: Write barriers.
+ *
+ * We overwrite a pair's tail once with nobody marking (no barrier should do
+ * anything), then again while marking is in progress. SATB has to log the
+ * pair that got overwritten, and Dijkstra has to shade the one that got
+ * stored. Which of those happen depends on what WRITE_BARRIER compiled in.
+ */
+void test20_WriteBarrier() {
+    printf("Test 20: Write Barriers.\n");
+    int satb = (WRITE_BARRIER & BARRIER_SATB) != 0;
+    int dijkstra = (WRITE_BARRIER & BARRIER_DIJKSTRA) != 0;
+    Collector savedCollector = collector;
+    int savedConcurrent = concurrentMark;
+    resetVM();
+    collector = COLLECTOR_MARK_SWEEP; // The treadmill is never idle
+    concurrentMark = 0;
+    maxObjects = 1 << 30; // We never collect here
+
+    pushInt(0);
+    pushInt(1);
+    pushInt(2);
+    Object* inner = pushPair();
+    Object* outer = pushPair(); // (0 . (1 . 2))
+    pushInt(3);
+    pushInt(4);
+    Object* value = pushPair();
+    pop();
+
+    setTail(outer, value);
+    setTail(outer, inner);
+    printf(" Logged %d pointers while idle (expected 0)\n", satbCount);
+
+    clearMarks();
+    markingActive = 1;
+    setTail(outer, value);
+    markingActive = 0;
+    printf(" Logged %d pointers while marking (expected %d)%s\n", satbCount,
+           satb, satbCount == 1 && satbLog[0] != inner ? " - wrong one!" : "");
+    printf(" Stored pair shaded: %s (expected %s), %d grey (expected %d)\n",
+           testAndSetMark(value) ? "yes" : "no", dijkstra ? "yes" : "no",
+           markStack.count, dijkstra);
+
+    markStack.count = 0;
+    resetVM();
+    collector = savedCollector;
+    concurrentMark = savedConcurrent;
+}
+
+/**
+ * Test 21: The copying collector.
+ *
+ * A 100-pair list and a two-pair cycle stay on the stack while we churn
+ * through garbage. Every collection should copy exactly the live objects,
+ * move them (the stack has to follow), keep the list's values and the
+ * cycle intact, and not make the heap any bigger than two semispaces.
+ */
+void test21_CopyingCollector() {
+    printf("Test 21: Copying Collector.\n");
+    Collector savedCollector = collector;
+    int savedGenerational = generational;
+    int savedGcLog = gcLog;
+    resetVM();
+    setGenerational(0);
+    collector = COLLECTOR_COPYING;
+
+    int length = 100;
+    pushInt(0);
+    for (int i = 0; i < length; i++) {
+        pushInt(i);
+        pushPair();
+    }
+    pushInt(1);
+    pushInt(2);
+    Object* a = pushPair();
+    pushInt(3);
+    pushInt(4);
+    Object* b = pushPair();
+    setTail(a, b);
+    setTail(b, a);
+    pop();
+    int live = immediateInts ? length + 2 : 2 * length + 1 + 4;
+
+    Object* before = stack[0];
+    long copiesBefore = fullCollections;
+    int mostPages = 0;
+    gcLog = 0;
+    for (int i = 0; i < 100000; i++) {
+        pushInt(i);
+        pop();
+        if (numPages > mostPages) mostPages = numPages;
+    }
+    gcLog = savedGcLog;
+    gc();
+    printf(" Survived %d objects (expected %d) after %ld copying GCs\n",
+           numObjects, live, fullCollections - copiesBefore);
+
+    int sum = 0;
+    int count = 0;
+    for (Object* pair = stack[0]; !isInt(pair); pair = pair->head) {
+        sum += intValue(pair->tail);
+        count++;
+    }
+    Object* cycle = stack[1];
+    printf(" List %s, %d pairs summing to %d (expected %d pairs, %d)\n",
+           stack[0] != before ? "moved" : "didn't move", count, sum, length,
+           length * (length - 1) / 2);
+    printf(" Cycle intact: %s (expected yes)\n",
+           cycle->tail->tail == cycle && intValue(cycle->head) == 1
+               ? "yes" : "no");
+    printf(" Heap peaked at %d pages (expected at most 4)\n", mostPages);
+
+    resetVM();
+    collector = savedCollector;
+    setGenerational(savedGenerational);
+}
+
+/**
+ * Test 22: Sliding compaction.
+ *
+ * We build a list with a garbage pair after every pair of it, so once the
+ * garbage is gone only a third of each int page and half of each pair page
+ * is still alive. That's well past the threshold, so the next GC should
+ * compact instead of sweeping: the list slides
+ * into as few pages as it fits in, the stack follows it, and the values
+ * and a cycle come through intact. The next allocation should be a plain
+ * bump right after the last survivor.
+ */
+void test22_Compaction() {
+    printf("Test 22: Sliding Compaction.\n");
+    double savedThreshold = compactThreshold;
+    Collector savedCollector = collector;
+    int savedGenerational = generational;
+    int savedImmediate = immediateInts;
+    resetVM();
+    setGenerational(0);
+    collector = COLLECTOR_MARK_SWEEP;
+    immediateInts = 0;
+    compactThreshold = 0.25;
+    maxObjects = 1 << 30; // We call gc() ourselves
+
+    int length = 5000;
+    pushInt(1);
+    pushInt(2);
+    Object* a = pushPair();
+    pushInt(3);
+    pushInt(4);
+    Object* b = pushPair();
+    setTail(a, b);
+    setTail(b, a);
+    pop();
+    pushInt(0);
+    for (int i = 0; i < length; i++) {
+        pushInt(i);
+        pushPair();
+        pushInt(-i);
+        pushInt(-i);
+        pushPair();
+        pop(); // Garbage right next to the list
+    }
+    int live = 2 * length + 1 + 4;
+    Object* before = stack[1];
+
+    long compactionsBefore = compactions;
+    long returnedBefore = pagesReturned;
+    int pagesBefore = numPages;
+    gc();
+    printf(" Survived %d objects (expected %d), %ld compaction (expected 1)\n",
+           numObjects, live, compactions - compactionsBefore);
+    int leafPages = (length + 1 + 2 + SLOTS_PER_PAGE - 1) / SLOTS_PER_PAGE;
+    int pairPages = (length + 2 + SLOTS_PER_PAGE - 1) / SLOTS_PER_PAGE;
+    printf(" Pages: %d -> %d (expected %d), %ld returned to the system\n",
+           pagesBefore, numPages, leafPages + pairPages,
+           pagesReturned - returnedBefore);
+
+    int sum = 0;
+    int count = 0;
+    for (Object* pair = stack[1]; !isInt(pair); pair = pair->head) {
+        sum += intValue(pair->tail);
+        count++;
+    }
+    Object* cycle = stack[0];
+    printf(" List %s, %d pairs summing to %d (expected %d pairs, %d)\n",
+           stack[1] != before ? "moved" : "didn't move", count, sum, length,
+           length * (length - 1) / 2);
+    printf(" Cycle intact: %s (expected yes)\n",
+           cycle->tail->tail == cycle && intValue(cycle->head) == 1
+               ? "yes" : "no");
+
+    Object* last = pageSlots(spaces[OBJ_PAIR].availPages) +
+                   spaces[OBJ_PAIR].availPages->bump - 1;
+    pushInt(7);
+    pushInt(8);
+    Object* fresh = pushPair();
+    printf(" Next pair bumped in right after the survivors: %s\n",
+           fresh == last + 1 ? "yes" : "no");
+
+    resetVM();
+    compactThreshold = savedThreshold;
+    collector = savedCollector;
+    immediateInts = savedImmediate;
+    setGenerational(savedGenerational);
+}
+
+/**
+ * Test 23: Immix (mark-region).
+ *
+ * We fill pages with a list that has garbage pairs woven through it, in
+ * runs: LINE_SLOTS list pairs, then LINE_SLOTS garbage pairs. After a GC,
+ * up to every other line of those pages is free (fewer where the runs
+ * don't line up with the lines), and new pairs should fill exactly those
+ * lines before the heap needs another page.
+ * Then we drop most of the list, so its pages end up nearly empty: the next
+ * GC picks them for evacuation, and the one after that has to move what's
+ * left out of them without losing anything.
+ */
+void test23_Immix() {
+    printf("Test 23: Immix Mark-Region.\n");
+    Collector savedCollector = collector;
+    int savedGenerational = generational;
+    int savedImmediate = immediateInts;
+    resetVM();
+    setGenerational(0);
+    collector = COLLECTOR_IMMIX;
+    immediateInts = 1; // Only pairs, so the lines are easy to count
+    maxObjects = 1 << 30; // We call gc() ourselves
+
+    int runs = 1000;
+    pushInt(0);
+    for (int r = 0; r < runs; r++) {
+        for (int i = 0; i < LINE_SLOTS; i++) {
+            pushInt(r);
+            pushPair();
+        }
+        for (int i = 0; i < LINE_SLOTS; i++) {
+            pushInt(-1);
+            pushInt(-1);
+            pushPair();
+            pop();
+        }
+    }
+    int live = runs * LINE_SLOTS;
+    gc();
+    printf(" Survived %d objects (expected %d)\n", numObjects, live);
+
+    // Every new pair should land in a line the garbage left behind
+    int freeSlots = 0;
+    for (int p = 0; p < numPages; p++) {
+        if (pages[p]->evacuating) continue; // Not allocated into
+        for (int line = 0; line < LINES_PER_PAGE; line++) {
+            if (lineInUse(pages[p], line)) continue;
+            int end = (line + 1) * LINE_SLOTS;
+            freeSlots += (end < SLOTS_PER_PAGE ? end : SLOTS_PER_PAGE) -
+                         line * LINE_SLOTS;
+        }
+    }
+    int pagesBefore = numPages;
+    int reused = 0;
+    for (int i = 0; i < freeSlots; i++) {
+        pushInt(1);
+        pushInt(2);
+        Object* pair = pushPair();
+        pop();
+        int slot = (int)(pair - pageSlots(pageOf(pair)));
+        if (!lineInUse(pageOf(pair), slot / LINE_SLOTS)) reused++;
+    }
+    printf(" New pairs bumped into free lines: %d of %d, %d new pages"
+           " (expected 0)\n", reused, freeSlots, numPages - pagesBefore);
+
+    // Keep only every 16th run: the list's pages are now nearly empty
+    Object* list = stack[0];
+    for (Object* pair = list; !isInt(pair); pair = pair->head) {
+        Object* next = pair;
+        for (int i = 0; i < 16 * LINE_SLOTS && !isInt(next); i++) {
+            next = next->head;
+        }
+        setHead(pair, next);
+    }
+    gc(); // Finds the sparse pages
+    Page* sparse[64];
+    int numSparse = 0;
+    for (int p = 0; p < numPages && numSparse < 64; p++) {
+        if (pages[p]->evacuating) sparse[numSparse++] = pages[p];
+    }
+    long evacuatedBefore = evacuatedObjects;
+    gc(); // Evacuates them
+    int count = 0;
+    int sum = 0;
+    int moved = 1;
+    for (Object* pair = stack[0]; !isInt(pair); pair = pair->head) {
+        sum += intValue(pair->tail);
+        count++;
+        for (int i = 0; i < numSparse; i++) {
+            if (pageOf(pair) == sparse[i]) moved = 0;
+        }
+    }
+    int kept = (runs + 15) / 16;
+    int expectedSum = 0;
+    for (int j = 0; j < kept; j++) expectedSum += runs - 1 - 16 * j;
+    printf(" Evacuated %ld objects (expected %d) from %d sparse pages,"
+           " all moved out: %s\n", evacuatedObjects - evacuatedBefore, kept,
+           numSparse, moved ? "yes" : "no");
+    printf(" List has %d pairs summing to %d (expected %d, %d)\n", count,
+           sum, kept, expectedSum);
+
+    resetVM();
+    collector = savedCollector;
+    immediateInts = savedImmediate;
+    setGenerational(savedGenerational);
+}
+
+/**
+ * Churns through garbage pairs while the list at stack[0] (built through
+ * its heads, values in its tails) stays alive. Every 16 garbage pairs, two
+ * of the list's values trade places with setTail(), so a running mark keeps
+ * having pointers moved out from under it.
+ */
+static void churnList(int length, int rounds) {
+    for (int i = 0; i < rounds; i++) {
+        pushInt(i);
+        pushInt(i);
+        pushPair();
+        pop();
+        if (i % 16 != 0) continue;
+
+        int k = (i / 16) % (length / 2);
+        Object* x = stack[0];
+        for (int n = 0; n < k; n++) x = x->head;
+        Object* y = x;
+        for (int n = k; n < length - 1 - k; n++) y = y->head;
+        push(x->tail);
+        setTail(x, y->tail);
+        setTail(y, pop());
+    }
+}
+
+/**
+ * Test 24: Incremental marking.
+ *
+ * A list stays on the stack while we churn through garbage pairs, so
+ * incremental marks keep running with the mutator going in between their
+ * steps. Every so often the mutator swaps two values in the list with
+ * setTail(), moving them out from under the marker - the barriers have to
+ * make sure none of them gets lost. The last gc() lands in the middle of a
+ * mark, which it should throw away and find exactly the list.
+ */
+void test24_IncrementalMark() {
+    printf("Test 24: Incremental Marking.\n");
+    if (!(WRITE_BARRIER & (BARRIER_SATB | BARRIER_DIJKSTRA))) {
+        printf(" Skipped: no marking barrier compiled in\n");
+        return;
+    }
+    Collector savedCollector = collector;
+    int savedGenerational = generational;
+    int savedIncremental = incrementalMark;
+    int savedConcurrent = concurrentMark;
+    int savedRatio = markWorkRatio;
+    int savedMicros = markStepMicros;
+    int savedTimeScheduled = timeScheduled;
+    int savedGcLog = gcLog;
+    resetVM();
+    setGenerational(0);
+    collector = COLLECTOR_MARK_SWEEP;
+    setIncremental(1);
+    concurrentMark = 0;
+    timeScheduled = 0;
+    markWorkRatio = 1;  // Mark slowly, so the mutator gets plenty of turns
+    markStepMicros = 0; // No time limit, so every run takes the same steps
+    gcLog = 0;
+
+    int length = 2000;
+    pushInt(0);
+    for (int i = 0; i < length; i++) {
+        pushInt(i);
+        pushPair();
+    }
+    long stepsBefore = markSteps;
+    long runsBefore = fullCollections;
+    churnList(length, 40000);
+
+    int sum = 0;
+    int count = 0;
+    for (Object* pair = stack[0]; !isInt(pair); pair = pair->head) {
+        sum += intValue(pair->tail);
+        count++;
+    }
+    printf(" Marked incrementally: %s, list has %d pairs summing to %d"
+           " (expected %d, %d)\n",
+           markSteps > stepsBefore && fullCollections > runsBefore ? "yes"
+                                                                  : "no",
+           count, sum, length, length * (length - 1) / 2);
+
+    while (!markingActive) {
+        pushInt(0);
+        pushInt(0);
+        pushPair();
+        pop();
+    }
+    gc();
+    int live = immediateInts ? length : 2 * length + 1;
+    printf(" Survived %d objects (expected %d), mark still running: %s"
+           " (expected no)\n", numObjects, live, markingActive ? "yes" : "no");
+
+    resetVM();
+    collector = savedCollector;
+    incrementalMark = savedIncremental;
+    concurrentMark = savedConcurrent;
+    markWorkRatio = savedRatio;
+    markStepMicros = savedMicros;
+    timeScheduled = savedTimeScheduled;
+    gcLog = savedGcLog;
+    setGenerational(savedGenerational);
+}
+
+/**
+ * Test 25: Concurrent marking.
+ *
+ * Once a mark starts we leave the marker thread alone until it says it's
+ * idle, so it has to have marked everything below the roots by itself.
+ * Then we churn and swap values like test 24 does, with the marker running
+ * alongside, and the list has to come out of it intact.
+ */
+void test25_ConcurrentMark() {
+    printf("Test 25: Concurrent Marking.\n");
+    if (!(WRITE_BARRIER & (BARRIER_SATB | BARRIER_DIJKSTRA))) {
+        printf(" Skipped: no marking barrier compiled in\n");
+        return;
+    }
+    Collector savedCollector = collector;
+    int savedGenerational = generational;
+    int savedIncremental = incrementalMark;
+    int savedConcurrent = concurrentMark;
+    int savedGcLog = gcLog;
+    resetVM();
+    setGenerational(0);
+    collector = COLLECTOR_MARK_SWEEP;
+    setIncremental(1);
+    concurrentMark = 1;
+    gcLog = 0;
+
+    int length = 2000;
+    pushInt(0);
+    for (int i = 0; i < length; i++) {
+        pushInt(i);
+        pushPair();
+    }
+    gc();
+    while (!markingActive) {
+        pushInt(0);
+        pushInt(0);
+        pushPair();
+        pop();
+    }
+    long markedBefore = concurrentMarked;
+    while (!__atomic_load_n(&markerIdle, __ATOMIC_ACQUIRE)) sched_yield();
+    stopMarker();
+    // Everything in the list but the first pair, which is a root
+    int below = immediateInts ? length - 1 : 2 * length;
+    printf(" Marker thread marked %ld objects (expected %d)\n",
+           concurrentMarked - markedBefore, below);
+    startMarker();
+
+    churnList(length, 40000);
+    int sum = 0;
+    int count = 0;
+    for (Object* pair = stack[0]; !isInt(pair); pair = pair->head) {
+        sum += intValue(pair->tail);
+        count++;
+    }
+    printf(" List has %d pairs summing to %d (expected %d, %d)\n", count, sum,
+           length, length * (length - 1) / 2);
+
+    gc();
+    int live = immediateInts ? length : 2 * length + 1;
+    printf(" Survived %d objects (expected %d)\n", numObjects, live);
+
+    resetVM();
+    collector = savedCollector;
+    incrementalMark = savedIncremental;
+    concurrentMark = savedConcurrent;
+    gcLog = savedGcLog;
+    setGenerational(savedGenerational);
+}
+
+/**
+ * Test 26: Baker's treadmill.
+ *
+ * The same list and churn as test 24, but on the treadmill: it should keep
+ * flipping without ever sweeping a page, the list has to come through in
+ * one piece, and gc() should leave exactly the list. Then we walk both
+ * rings to check that the segments are where the sentinels say, the counts
+ * match, and every slot of every page is on exactly one of them.
+ */
+void test26_Treadmill() {
+    printf("Test 26: Baker's Treadmill.\n");
+    if (!(WRITE_BARRIER & (BARRIER_SATB | BARRIER_DIJKSTRA))) {
+        printf(" Skipped: no marking barrier compiled in\n");
+        return;
+    }
+    Collector savedCollector = collector;
+    int savedGenerational = generational;
+    int savedConcurrent = concurrentMark;
+    int savedGcLog = gcLog;
+    resetVM();
+    setGenerational(0);
+    collector = COLLECTOR_TREADMILL;
+    concurrentMark = 0;
+    gcLog = 0;
+
+    int length = 1000;
+    pushInt(0);
+    for (int i = 0; i < length; i++) {
+        pushInt(i);
+        pushPair();
+    }
+    long flipsBefore = fullCollections;
+    long sweptBefore = pagesSweptEager + pagesSweptLazy + pagesSweptBackground;
+    churnList(length, 40000);
+
+    int sum = 0;
+    int count = 0;
+    for (Object* pair = stack[0]; !isInt(pair); pair = pair->head) {
+        sum += intValue(pair->tail);
+        count++;
+    }
+    printf(" Flipped: %s, pages swept: %ld (expected 0)\n",
+           fullCollections > flipsBefore ? "yes" : "no",
+           pagesSweptEager + pagesSweptLazy + pagesSweptBackground -
+               sweptBefore);
+    printf(" List has %d pairs summing to %d (expected %d, %d)\n", count, sum,
+           length, length * (length - 1) / 2);
+
+    gc();
+    int live = immediateInts ? length : 2 * length + 1;
+    printf(" Survived %d objects (expected %d)\n", numObjects, live);
+
+    int consistent = 1;
+    long cells = 0;
+    long inUse = 0;
+    for (int t = 0; t < NUM_OBJECT_TYPES; t++) {
+        Treadmill* ring = &treadmills[t];
+        TreadmillLink* sentinels[4] = {ring->blackS, ring->greyS,
+                                       ring->whiteS, ring->freeS};
+        int counts[4] = {0};
+        int segment = 0;
+        for (TreadmillLink* link = ring->blackS->next; link != ring->blackS;
+             link = link->next) {
+            if (link->next->prev != link) consistent = 0;
+            if (segment < 3 && link == sentinels[segment + 1]) {
+                segment++;
+            } else if (objectType(objectOf(link)) != (ObjectType)t) {
+                consistent = 0;
+            } else {
+                counts[segment]++;
+            }
+        }
+        if (segment != 3 || counts[0] != ring->black ||
+            counts[1] != ring->grey || counts[2] != ring->white ||
+            counts[3] != ring->free) {
+            consistent = 0;
+        }
+        cells += ring->black + ring->grey + ring->white + ring->free;
+        inUse += ring->black + ring->grey + ring->white;
+    }
+    printf(" Rings account for every slot: %s (expected yes)\n",
+           consistent && cells == (long)numPages * SLOTS_PER_PAGE &&
+                   inUse == numObjects
+               ? "yes"
+               : "no");
+
+    resetVM();
+    collector = savedCollector;
+    concurrentMark = savedConcurrent;
+    gcLog = savedGcLog;
+    setGenerational(savedGenerational);
+}
+
+/**
+ * Test 27: Time-based scheduling.
+ *
+ * The same list and churn as test 24, with marking on a 200us grid that
+ * leaves the mutator half of every 2ms. The list has to come through, the
+ * marking has to happen in quanta, and no 2ms window may have the
+ * collector in it for more than half of it.
+ * A quantum only looks at the clock every 32 units of marking, so it gets
+ * a little slack on that.
+ */
+void test27_Metronome() {
+    printf("Test 27: Time-Based Scheduling.\n");
+    if (!(WRITE_BARRIER & (BARRIER_SATB | BARRIER_DIJKSTRA))) {
+        printf(" Skipped: no marking barrier compiled in\n");
+        return;
+    }
+    Collector savedCollector = collector;
+    int savedGenerational = generational;
+    int savedIncremental = incrementalMark;
+    int savedConcurrent = concurrentMark;
+    int savedTimeScheduled = timeScheduled;
+    int savedQuantum = gcQuantumMicros;
+    int savedWindow = gcWindowMicros;
+    double savedMmu = targetMmu;
+    SweepMode savedSweep = sweepMode;
+    int savedGcLog = gcLog;
+    resetVM();
+    setGenerational(0);
+    collector = COLLECTOR_MARK_SWEEP;
+    concurrentMark = 0;
+    sweepMode = SWEEP_LAZY; // Keeps the pause at the end of a mark short
+    gcQuantumMicros = 200;
+    gcWindowMicros = 2000;
+    targetMmu = 0.5;
+    setTimeScheduled(1);
+    gcLog = 0;
+
+    int length = 2000;
+    pushInt(0);
+    for (int i = 0; i < length; i++) {
+        pushInt(i);
+        pushPair();
+    }
+    long stepsBefore = markSteps;
+    long runsBefore = fullCollections;
+    recordGcTimes = 1;
+    numGcTimes = 0;
+    double from = nowSeconds();
+    churnList(length, 100000);
+    double to = nowSeconds();
+    recordGcTimes = 0;
+
+    int sum = 0;
+    int count = 0;
+    for (Object* pair = stack[0]; !isInt(pair); pair = pair->head) {
+        sum += intValue(pair->tail);
+        count++;
+    }
+    printf(" Marked in quanta: %s, list has %d pairs summing to %d"
+           " (expected yes, %d, %d)\n",
+           markSteps > stepsBefore && fullCollections > runsBefore ? "yes"
+                                                                  : "no",
+           count, sum, length, length * (length - 1) / 2);
+    double mmu = minimumMutatorUtilization(from, to, 2e-3);
+    printf(" Mutator got half of every 2ms window: %s (expected yes)\n",
+           mmu >= targetMmu - 0.05 ? "yes" : "no");
+
+    numGcTimes = 0;
+    resetVM();
+    collector = savedCollector;
+    concurrentMark = savedConcurrent;
+    sweepMode = savedSweep;
+    gcQuantumMicros = savedQuantum;
+    gcWindowMicros = savedWindow;
+    targetMmu = savedMmu;
+    setTimeScheduled(savedTimeScheduled);
+    incrementalMark = savedIncremental;
+    gcLog = savedGcLog;
+    setGenerational(savedGenerational);
+}
+
+/**
+ * Test 28: Heap growth policies.
+ *
+ * The same list survives a gc() under each policy in turn, and each one
+ * should put the next collection where it says it will. The live ratio
+ * policy should leave the limit alone when the list grows a little, the
+ * cap should win over the growth factor, and an empty heap should get the
+ * minimum rather than a limit of 0.
+ */
+void test28_GrowthPolicy() {
+    printf("Test 28: Heap Growth Policies.\n");
+    Collector savedCollector = collector;
+    int savedGenerational = generational;
+    GrowthPolicy savedPolicy = growthPolicy;
+    double savedFactor = growthFactor;
+    int savedGogc = gogcPercent;
+    double savedRatio = targetLiveRatio;
+    int savedCap = maxHeapObjects;
+    int savedMin = minHeapObjects;
+    int savedGcLog = gcLog;
+    resetVM();
+    setGenerational(0);
+    collector = COLLECTOR_MARK_SWEEP;
+    minHeapObjects = INITIAL_GC_THRESHOLD;
+    gcLog = 0;
+
+    maxObjects = 1 << 30; // Just build, don't collect
+    pushInt(0);
+    for (int i = 0; i < 1000; i++) {
+        pushInt(i);
+        pushPair();
+    }
+    gc();
+    int live = numObjects;
+
+    growthPolicy = GROWTH_FACTOR;
+    growthFactor = 3;
+    gc();
+    printf(" Factor 3: next GC at %d (expected %d)\n", maxObjects, 3 * live);
+
+    growthPolicy = GROWTH_GOGC;
+    gogcPercent = 50;
+    gc();
+    printf(" GOGC 50: next GC at %d (expected %d)\n", maxObjects,
+           live + live / 2);
+
+    growthPolicy = GROWTH_LIVE_RATIO;
+    targetLiveRatio = 0.25;
+    gc();
+    int limit = maxObjects;
+    for (int i = 0; i < 10; i++) {
+        pushInt(i);
+        pushPair();
+    }
+    gc();
+    printf(" Live ratio 0.25: next GC at %d (expected %d), then %d after"
+           " growing a little (expected %d)\n",
+           limit, 4 * live, maxObjects, 4 * live);
+
+    growthPolicy = GROWTH_MAX_HEAP;
+    growthFactor = 2;
+    maxHeapObjects = numObjects + numObjects / 2;
+    gc();
+    printf(" Max heap %d: next GC at %d (expected %d)\n", maxHeapObjects,
+           maxObjects, maxHeapObjects);
+
+    growthPolicy = GROWTH_FACTOR;
+    stackSize = 0;
+    gc();
+    printf(" Empty heap: next GC at %d (expected %d)\n", maxObjects,
+           INITIAL_GC_THRESHOLD);
+
+    resetVM();
+    collector = savedCollector;
+    growthPolicy = savedPolicy;
+    growthFactor = savedFactor;
+    gogcPercent = savedGogc;
+    targetLiveRatio = savedRatio;
+    maxHeapObjects = savedCap;
+    minHeapObjects = savedMin;
+    gcLog = savedGcLog;
+    setGenerational(savedGenerational);
+}
+
+/**
+ * Builds a big graph of pairs that's deliberately bad for the cache.
+ *
+ * Every pair's tail points to the next pair in a random order (so everything
+ * is reachable from the first one) and its head points to a random pair.
+ * Following the pointers jumps all over the heap, just like a real
+ * pointer-heavy workload. The entry pair ends up on the stack.
+ */
+static void pushRandomGraph(int count) {
+    Object** nodes = malloc(count * sizeof(Object*));
+    if (nodes == NULL) {
+        printf("Out of memory!\n");
+        exit(1);
+    }
+    maxObjects = count * 4; // Don't let GC run while nothing is rooted
+    for (int i = 0; i < count; i++) {
+        nodes[i] = newObject(OBJ_PAIR);
+    }
+
+    // Shuffle, then chain the tails in shuffled order
+    srand(42);
+    for (int i = count - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        Object* tmp = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = tmp;
+    }
+    for (int i = 0; i < count; i++) {
+        nodes[i]->tail = i + 1 < count ? nodes[i + 1] : NULL;
+        nodes[i]->head = nodes[rand() % count];
+    }
+    push(nodes[0]);
+    free(nodes);
+}
+
+/**
+ * Times just the mark phase over whatever is on the stack right now and
+ * returns how many objects per second it marked.
+ */
+static double timeMark() {
+    retireAllocBuffer();
+    clearMarks();
+    double start = nowSeconds();
+    markAll();
+    double seconds = nowSeconds() - start;
+
+    int marked = 0;
+    for (int p = 0; p < numPages; p++) {
+        marked += countMarks(pages[p]);
+    }
+    return seconds > 0 ? marked / seconds : 0;
+}
+
+/**
+ * Benchmark: how fast can we mark a pointer-chasing graph, with and without
+ * prefetching?
+ */
+void benchMarkPrefetch() {
+    printf("Benchmark: Mark throughput, prefetch off vs on.\n");
+    int sizes[] = {100000, 1000000, 4000000};
+
+    for (int s = 0; s < 3; s++) {
+        resetVM();
+        pushRandomGraph(sizes[s]);
+
+        markPrefetch = 0;
+        double off = timeMark();
+        markPrefetch = 1;
+        double on = timeMark();
+
+        printf(" %8d pairs: %7.1f M objects/sec off | %7.1f M objects/sec on"
+               " | %.2fx\n", sizes[s], off / 1e6, on / 1e6,
+               off > 0 ? on / off : 0);
+    }
+    resetVM();
+}
+
+/**
+ * Benchmark: how does the mark phase scale with GC threads?
+ *
+ * "Wide" is 128 separate balanced trees, so there's plenty of work to spread
+ * around. "Deep" is one long chain, which is inherently sequential - only
+ * one object at a time is ever grey - so it shows the worst case.
+ */
+void benchParallelMark() {
+    printf("Benchmark: Parallel mark speedup (1/2/4/8 threads).\n");
+    int threads[] = {1, 2, 4, 8};
+    int savedWorkers = gcWorkers;
+
+    for (int shape = 0; shape < 2; shape++) {
+        resetVM();
+        maxObjects = 1 << 30; // Just build, don't collect
+        if (shape == 0) {
+            for (int i = 0; i < 128; i++) pushTree(13);
+        } else {
+            pushInt(0);
+            for (int i = 0; i < 1000000; i++) {
+                pushInt(i);
+                pushPair();
+            }
+        }
+
+        double base = 0;
+        for (int t = 0; t < 4; t++) {
+            setGcWorkers(threads[t]);
+            timeMark(); // Warm up
+            double rate = timeMark();
+            if (t == 0) base = rate;
+            printf(" %s, %d thread%s: %7.1f M objects/sec | %.2fx\n",
+                   shape == 0 ? "wide" : "deep", threads[t],
+                   threads[t] == 1 ? " " : "s", rate / 1e6,
+                   base > 0 ? rate / base : 0);
+        }
+    }
+    setGcWorkers(savedWorkers);
+    resetVM();
+}
+
+/**
+ * Benchmark: how does the sweep scale with GC threads?
+ *
+ * We fill the heap with 10 million objects where only 1 in 100 survives (a
+ * long list holds the survivors), mark once, and time just the sweep.
+ */
+void benchParallelSweep() {
+    printf("Benchmark: Parallel sweep of 10M objects, 99%% garbage.\n");
+    int threads[] = {1, 2, 4, 8};
+    int savedWorkers = gcWorkers;
+    double base = 0;
+
+    for (int t = 0; t < 4; t++) {
+        setGcWorkers(threads[t]);
+        resetVM();
+        maxObjects = 1 << 30; // Just build, don't collect
+        pushInt(0);
+        for (int i = 0; i < 10000000; i++) {
+            pushInt(i);
+            if (i % 100 == 0) pushPair(); // Survivor: hang it on the list
+            else pop();                   // Garbage
+        }
+        retireAllocBuffer();
+        clearMarks();
+        markAll();
+
+        double start = nowSeconds();
+        sweep();
+        double seconds = nowSeconds() - start;
+        if (t == 0) base = seconds;
+        printf(" %d thread%s: %8.3f ms, %d pages, %d survivors | %.2fx\n",
+               threads[t], threads[t] == 1 ? " " : "s", seconds * 1e3,
+               numPages, numObjects, seconds > 0 ? base / seconds : 0);
+    }
+    setGcWorkers(savedWorkers);
+    resetVM();
+}
+
+/**
+ * Benchmark: does sweeping a dead heap cost per page or per object?
+ *
+ * Everything in the heap is garbage, so every page should be handed back
+ * whole after a quick look at its bitmap. For contrast we also keep one
+ * object alive per page, which forces a full free-list rebuild everywhere.
+ * The heap is all pairs (the ints are immediate), because a leaf page with
+ * a survivor doesn't rebuild anything - it just keeps its bitmap holes.
+ */
+void benchDeadPageSweep() {
+    printf("Benchmark: Sweeping all-dead pages vs one survivor per page.\n");
+    int savedImmediate = immediateInts;
+    immediateInts = 1;
+    int sizes[] = {1000000, 10000000};
+
+    for (int s = 0; s < 2; s++) {
+        for (int keep = 0; keep < 2; keep++) {
+            resetVM();
+            maxObjects = 1 << 30; // Just build, don't collect
+            pushInt(0);
+            for (int i = 0; i < sizes[s]; i++) {
+                pushInt(i);
+                if (keep && i % SLOTS_PER_PAGE == 0) {
+                    pushPair(); // Onto the list
+                } else {
+                    pushInt(i);
+                    pushPair();
+                    pop();
+                }
+            }
+            retireAllocBuffer();
+            clearMarks();
+            markAll();
+
+            int before = numPages;
+            double start = nowSeconds();
+            sweep();
+            double seconds = nowSeconds() - start;
+            printf(" %8d objects, %s: %8.3f ms | %6.1f ns/page |"
+                   " %5.2f ns/object\n", sizes[s],
+                   keep ? "1 live/page" : "all dead   ", seconds * 1e3,
+                   seconds * 1e9 / before, seconds * 1e9 / sizes[s]);
+        }
+    }
+    immediateInts = savedImmediate;
+    resetVM();
+}
+
+/**
+ * Benchmark: what does clearing the mark bitmaps cost on a heap that mostly
+ * survives?
+ *
+ * We build a big long-lived list, then run GC cycles that each also find
+ * some fresh garbage (about 1 object in 10), with and without epoch
+ * flipping. We measure the whole pause and how many bitmap bytes each cycle
+ * writes outside of marking itself.
+ */
+void benchMarkEpochFlip() {
+    printf("Benchmark: Clearing mark bitmaps vs flipping the mark sense.\n");
+    SweepMode savedMode = sweepMode;
+    sweepMode = SWEEP_EAGER;
+    int cycles = 10;
+
+    for (int flip = 0; flip < 2; flip++) {
+        resetVM();
+        setEpochFlip(flip);
+        maxObjects = 1 << 30; // We call gc() ourselves
+        pushInt(0);
+        for (int i = 0; i < 2000000; i++) {
+            pushInt(i);
+            pushPair();
+        }
+        gc(); // Warm up
+        long written = 0;
+        double seconds = 0;
+        for (int c = 0; c < cycles; c++) {
+            for (int i = 0; i < 400000; i++) {
+                pushInt(i);
+                pop(); // Garbage for this cycle
+            }
+            retireAllocBuffer();
+            long before = bitmapBytesWritten;
+            double start = nowSeconds();
+            clearMarks();
+            markAll();
+            sweep();
+            seconds += nowSeconds() - start;
+            written += bitmapBytesWritten - before;
+        }
+        seconds /= cycles;
+        written /= cycles;
+        printf(" %s: %8.3f ms/cycle | %8ld bitmap bytes/cycle | %d pages\n",
+               flip ? "flip sense " : "clear bits ", seconds * 1e3,
+               written, numPages);
+    }
+    setEpochFlip(1);
+    sweepMode = savedMode;
+    resetVM();
+}
+
+/**
+ * Benchmark: boxed vs immediate integers.
+ *
+ * The same loops as test 6 (make an integer, throw it away) plus a list
+ * builder where every pair holds an integer, with automatic GC as usual.
+ * Boxed ints each cost a heap slot and keep the collector busy; immediate
+ * ones never touch the heap. Nothing survives the churn, so it gets a 64K
+ * object heap - the smallest one would collect every 8 allocations.
+ */
+void benchImmediateInts() {
+    printf("Benchmark: Boxed vs immediate integers.\n");
+    int savedImmediate = immediateInts;
+    int savedMinHeap = minHeapObjects;
+    int savedGcLog = gcLog;
+    int count = 10000000;
+    gcLog = 0;
+
+    for (int immediate = 0; immediate < 2; immediate++) {
+        immediateInts = immediate;
+        resetVM();
+        maxObjects = minHeapObjects = 1 << 16;
+        long before = (long)markEpoch;
+        double start = nowSeconds();
+        for (int i = 0; i < count; i++) {
+            pushInt(i);
+            pop();
+        }
+        double churn = nowSeconds() - start;
+        long churnGcs = (long)markEpoch - before;
+        int churnPages = numPages;
+
+        resetVM();
+        minHeapObjects = savedMinHeap;
+        start = nowSeconds();
+        pushInt(0);
+        for (int i = 0; i < count / 10; i++) {
+            pushInt(i);
+            pushPair();
+        }
+        gc();
+        double list = nowSeconds() - start;
+        printf(" %s: churn %6.2f ns/int (%ld GCs, %d pages) |"
+               " %d-int list %8.3f ms, %d objects, %d pages\n",
+               immediate ? "immediate" : "boxed    ", churn * 1e9 / count,
+               churnGcs, churnPages, count / 10, list * 1e3, numObjects,
+               numPages);
+    }
+    immediateInts = savedImmediate;
+    gcLog = savedGcLog;
+    resetVM();
+}
+
+/**
+ * Benchmark: how big is an object, and what does that cost when marking a
+ * long list?
+ *
+ * Prints the slot size and the bytes each object really takes once the page
+ * header and mark bitmap are shared out, then builds a 4M-pair list (with
+ * boxed and with immediate integers) and times marking it.
+ */
+void benchObjectLayout() {
+    printf("Benchmark: Object layout.\n");
+    printf(" sizeof(Object) = %d bytes, %d slots per %d KB page,"
+           " %.2f bytes per object with page overhead\n",
+           (int)sizeof(Object), SLOTS_PER_PAGE, PAGE_SIZE / 1024,
+           (double)PAGE_SIZE / SLOTS_PER_PAGE);
+    int savedImmediate = immediateInts;
+    int length = 4000000;
+
+    for (int immediate = 0; immediate < 2; immediate++) {
+        immediateInts = immediate;
+        resetVM();
+        maxObjects = 1 << 30; // Just build, don't collect
+        pushInt(0);
+        for (int i = 0; i < length; i++) {
+            pushInt(i);
+            pushPair();
+        }
+        retireAllocBuffer();
+        clearMarks();
+        double start = nowSeconds();
+        markAll();
+        double seconds = nowSeconds() - start;
+        printf(" %s ints: %8d objects in %5d pages (%6.1f MB) |"
+               " mark %8.3f ms, %5.2f ns/object\n",
+               immediate ? "immediate" : "boxed    ", numObjects, numPages,
+               numPages * (double)PAGE_SIZE / (1 << 20), seconds * 1e3,
+               seconds * 1e9 / numObjects);
+    }
+    immediateInts = savedImmediate;
+    resetVM();
+}
+
+/**
+ * Benchmark: full vs generational collection on a mostly-young workload.
+ *
+ * A long-lived list of 1M pairs sits on the heap while we churn through
+ * 20M integers that die straight away (test 6's pattern, scaled up). Every
+ * full collection has to mark the whole list; a minor one only looks at
+ * the nursery.
+ */
+void benchGenerational() {
+    printf("Benchmark: Full vs generational collection.\n");
+    int savedGenerational = generational;
+    int savedNursery = nurserySize;
+    int savedGcLog = gcLog;
+    int churn = 20000000;
+    int modes = (WRITE_BARRIER & BARRIER_CARD) ? 2 : 1;
+    gcLog = 0;
+
+    for (int gen = 0; gen < modes; gen++) {
+        resetVM();
+        setGenerational(gen);
+        nurserySize = 65536;
+        pushInt(0);
+        for (int i = 0; i < 1000000; i++) {
+            pushInt(i);
+            pushPair();
+        }
+
+        long runs = minorCollections + fullCollections;
+        long fullBefore = fullCollections;
+        long count = 0;
+        double worst = 0;
+        double paused = 0;
+        double start = nowSeconds();
+        for (int i = 0; i < churn; i++) {
+            pushInt(i);
+            pop();
+            if (minorCollections + fullCollections != runs) {
+                runs = minorCollections + fullCollections;
+                count++;
+                paused += lastGcPause;
+                if (lastGcPause > worst) worst = lastGcPause;
+            }
+        }
+        double seconds = nowSeconds() - start;
+        printf(" %s: %6.3f s total | %5ld GCs (%ld full) | avg pause"
+               " %8.3f ms | max pause %8.3f ms\n",
+               gen ? "generational" : "full only   ", seconds, count,
+               fullCollections - fullBefore,
+               count ? paused * 1e3 / count : 0, worst * 1e3);
+    }
+    nurserySize = savedNursery;
+    setGenerational(savedGenerational);
+    gcLog = savedGcLog;
+    resetVM();
+}
+
+/*
+ * One store loop per barrier, so each is timed with the barrier inlined the
+ * way setTail() would have it, and nothing else in the loop.
+ */
+#define MUTATION_LOOP(name, store)                                           \
+    static double name(Object** pairs, Object** values, int mask,           \
+                       int stores) {                                        \
+        double start = nowSeconds();                                        \
+        for (int i = 0; i < stores; i++) {                                  \
+            Object* pair = pairs[i & mask];                                 \
+            Object* value = values[(i * 7) & mask];                         \
+            store;                                                          \
+        }                                                                   \
+        return (nowSeconds() - start) * 1e9 / stores;                       \
+    }
+
+MUTATION_LOOP(mutateNone, pair->tail = value)
+MUTATION_LOOP(mutateCard, cardBarrier(pair, value); pair->tail = value)
+MUTATION_LOOP(mutateSatb, satbBarrier(pair->tail); pair->tail = value)
+MUTATION_LOOP(mutateDijkstra, dijkstraBarrier(value); pair->tail = value)
+MUTATION_LOOP(mutateSetTail, setTail(pair, value))
+
+/**
+ * Builds a list of 'count' pairs on the stack and writes them into 'pairs'.
+ */
+static void buildPairs(Object** pairs, int count) {
+    pushInt(0);
+    for (int i = 0; i < count; i++) {
+        pushInt(i);
+        pairs[i] = pushPair();
+    }
+}
+
+/**
+ * Benchmark: what does each write barrier cost a mutator that does nothing
+ * but pointer stores?
+ *
+ * 20M tail stores across 64K pairs, first with no barrier, then with each
+ * barrier on its own, both when it has nothing to do (no marking running,
+ * an old pair getting an old child) and when it has to act. The last line
+ * is setTail() itself, with whatever WRITE_BARRIER compiled in.
+ */
+void benchWriteBarrier() {
+    printf("Benchmark: Write barrier cost (built with%s%s%s%s).\n",
+           WRITE_BARRIER == BARRIER_NONE ? " no barrier" : "",
+           (WRITE_BARRIER & BARRIER_CARD) ? " card" : "",
+           (WRITE_BARRIER & BARRIER_SATB) ? " satb" : "",
+           (WRITE_BARRIER & BARRIER_DIJKSTRA) ? " dijkstra" : "");
+    int count = 65536;
+    int mask = count - 1;
+    int stores = 20000000;
+    Object** pairs = malloc(count * sizeof(Object*));
+    Object** young = malloc(count * sizeof(Object*));
+    if (pairs == NULL || young == NULL) {
+        printf("Out of memory!\n");
+        exit(1);
+    }
+    int savedGenerational = generational;
+    resetVM();
+    setGenerational(0);
+    maxObjects = 1 << 30; // The stores break the list, so never collect
+    buildPairs(pairs, count);
+
+    printf(" no barrier          : %5.2f ns/store\n",
+           mutateNone(pairs, pairs, mask, stores));
+    printf(" satb, idle          : %5.2f ns/store\n",
+           mutateSatb(pairs, pairs, mask, stores));
+    clearMarks();
+    markingActive = 1;
+    double ns = mutateSatb(pairs, pairs, mask, stores);
+    printf(" satb, marking       : %5.2f ns/store (logged %d)\n", ns,
+           satbCount);
+    markingActive = 0;
+    satbCount = 0;
+    printf(" dijkstra, idle      : %5.2f ns/store\n",
+           mutateDijkstra(pairs, pairs, mask, stores));
+    clearMarks();
+    markingActive = 1;
+    ns = mutateDijkstra(pairs, pairs, mask, stores);
+    printf(" dijkstra, marking   : %5.2f ns/store (shaded %d)\n", ns,
+           markStack.count);
+    markingActive = 0;
+    markStack.count = 0;
+    printf(" setTail(), idle     : %5.2f ns/store\n",
+           mutateSetTail(pairs, pairs, mask, stores));
+
+    if (WRITE_BARRIER & BARRIER_CARD) {
+        resetVM();
+        setGenerational(1);
+        buildPairs(pairs, count);
+        for (int i = 0; i < promotionAge; i++) minorGc();
+        maxObjects = 1 << 30;
+        buildPairs(young, count);
+        printf(" card, old -> old    : %5.2f ns/store\n",
+               mutateCard(pairs, pairs, mask, stores));
+        ns = mutateCard(pairs, young, mask, stores);
+        printf(" card, old -> young  : %5.2f ns/store (%d dirty pages)\n",
+               ns, numDirtyPages);
+    }
+
+    free(pairs);
+    free(young);
+    resetVM();
+    setGenerational(savedGenerational);
+}
+
+/**
+ * Benchmark: mark-sweep vs copying when almost everything is garbage.
+ *
+ * First one collection of a heap of 1M or 4M objects where only one in
+ * every thousand is still reachable: mark-sweep has to sweep every page,
+ * copying only touches the survivors. Then 20M integers of churn with a
+ * 1000-pair list alive the whole time, collecting as often as the heap
+ * growth rule says.
+ */
+void benchCopying() {
+    printf("Benchmark: Mark-sweep vs copying collection.\n");
+    Collector savedCollector = collector;
+    int savedGenerational = generational;
+    int savedGcLog = gcLog;
+    const char* names[] = {"mark-sweep", "copying   "};
+    gcLog = 0;
+
+    for (int size = 1000000; size <= 4000000; size *= 4) {
+        for (int c = 0; c < 2; c++) {
+            resetVM();
+            setGenerational(0);
+            collector = (Collector)c;
+            maxObjects = 1 << 30; // Just build, don't collect
+            pushInt(0);
+            for (int i = 0; i < size; i++) {
+                pushInt(i);
+                if (i % 1000 == 0) pushPair();
+                else pop();
+            }
+            int pagesBefore = numPages;
+            double start = nowSeconds();
+            gc();
+            double seconds = nowSeconds() - start;
+            printf(" %s: %8d objects in %4d pages -> %5d live | pause"
+                   " %8.3f ms\n", names[c], size + size / 1000 + 1,
+                   pagesBefore, numObjects, seconds * 1e3);
+        }
+    }
+
+    for (int c = 0; c < 2; c++) {
+        resetVM();
+        setGenerational(0);
+        collector = (Collector)c;
+        pushInt(0);
+        for (int i = 0; i < 1000; i++) {
+            pushInt(i);
+            pushPair();
+        }
+        long runs = fullCollections;
+        double start = nowSeconds();
+        for (int i = 0; i < 20000000; i++) {
+            pushInt(i);
+            pop();
+        }
+        double seconds = nowSeconds() - start;
+        printf(" %s: 20M churn in %6.3f s, %ld GCs\n", names[c], seconds,
+               fullCollections - runs);
+    }
+
+    resetVM();
+    collector = savedCollector;
+    gcLog = savedGcLog;
+    setGenerational(savedGenerational);
+}
+
+/**
+ * Benchmark: sweeping vs compacting a fragmented heap.
+ *
+ * A 1M-pair list is built with a garbage pair after every pair of it, then
+ * collected once with compaction off and once with it on. After that we
+ * time marking the list (a compacted list is dense, so each cache line
+ * holds twice as many of its pairs) and allocating 1M more pairs (free-list
+ * pops after a sweep, bumps after a compaction).
+ */
+void benchCompaction() {
+    printf("Benchmark: Sweep vs compact on a fragmented heap.\n");
+    double savedThreshold = compactThreshold;
+    int savedGenerational = generational;
+    int savedGcLog = gcLog;
+    int length = 1000000;
+    gcLog = 0;
+
+    for (int c = 0; c < 2; c++) {
+        resetVM();
+        setGenerational(0);
+        compactThreshold = c ? 0.25 : 0;
+        maxObjects = 1 << 30; // We call gc() ourselves
+        pushInt(0);
+        for (int i = 0; i < length; i++) {
+            pushInt(i);
+            pushPair();
+            pushInt(i);
+            pushInt(i);
+            pushPair();
+            pop();
+        }
+        int pagesBefore = numPages;
+        double fragmentation = 0;
+        clearMarks();
+        markAll();
+        fragmentation = heapFragmentation();
+
+        double start = nowSeconds();
+        gc();
+        double pause = nowSeconds() - start;
+        int pagesAfter = numPages;
+
+        clearMarks();
+        start = nowSeconds();
+        markAll();
+        double mark = nowSeconds() - start;
+
+        start = nowSeconds();
+        for (int i = 0; i < length; i++) {
+            pushInt(i);
+            pushInt(i);
+            pushPair();
+            pop();
+        }
+        double alloc = nowSeconds() - start;
+        printf(" %s: %.0f%% fragmented, %4d -> %4d pages | gc %7.3f ms |"
+               " mark list %7.3f ms | 1M allocs %7.3f ms\n",
+               c ? "compact" : "sweep  ", fragmentation * 100, pagesBefore,
+               pagesAfter, pause * 1e3, mark * 1e3, alloc * 1e3);
+    }
+
+    resetVM();
+    compactThreshold = savedThreshold;
+    gcLog = savedGcLog;
+    setGenerational(savedGenerational);
+}
+
+/**
+ * Benchmark: mark-sweep vs Immix on a mixed live/dead workload.
+ *
+ * 64 root slots each hold a list. Each round replaces a random one with a
+ * new list of random length, so lists of every age die all over the heap
+ * while others live on. We time the whole run (allocation and GC), then
+ * how full the heap's pages are and how long marking the survivors takes.
+ */
+void benchImmix() {
+    printf("Benchmark: Mark-sweep vs Immix on mixed lifetimes.\n");
+    Collector savedCollector = collector;
+    int savedGenerational = generational;
+    int savedGcLog = gcLog;
+    Collector kinds[] = {COLLECTOR_MARK_SWEEP, COLLECTOR_IMMIX};
+    const char* names[] = {"mark-sweep", "immix     "};
+    int roots = 64;
+    gcLog = 0;
+
+    for (int c = 0; c < 2; c++) {
+        resetVM();
+        setGenerational(0);
+        collector = kinds[c];
+        srand(1);
+        for (int i = 0; i < roots; i++) pushInt(i);
+        long runs = fullCollections;
+        long evacuatedBefore = evacuatedObjects;
+        double paused = 0;
+        double start = nowSeconds();
+        for (int round = 0; round < 20000; round++) {
+            int slot = rand() % roots;
+            int length = 1 + rand() % 2000;
+            pushInt(0);
+            for (int i = 0; i < length; i++) {
+                pushInt(i);
+                pushPair();
+                if (fullCollections != runs) {
+                    runs = fullCollections;
+                    paused += lastGcPause;
+                }
+            }
+            stack[slot] = pop();
+        }
+        double seconds = nowSeconds() - start;
+
+        gc();
+        clearMarks();
+        start = nowSeconds();
+        markAll();
+        double mark = nowSeconds() - start;
+        printf(" %s: %6.3f s total (%6.3f s in GC) | %7d live in %4d pages"
+               " (%4.1f%% full) | mark %6.3f ms | evacuated %ld\n",
+               names[c], seconds, paused, numObjects, numPages,
+               100.0 * numObjects / ((double)numPages * SLOTS_PER_PAGE),
+               mark * 1e3, evacuatedObjects - evacuatedBefore);
+    }
+
+    resetVM();
+    collector = savedCollector;
+    gcLog = savedGcLog;
+    setGenerational(savedGenerational);
+}
+
+static int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Request latency with a big live heap: stop-the-world vs incremental
+ * marking vs concurrent marking vs the treadmill. Each "request" allocates
+ * REQUEST_PAIRS short-lived pairs and gets timed on its own, so a
+ * collection shows up as one slow request.
+ * A 500K-pair list stays alive the whole time, which makes a full mark
+ * several milliseconds long.
+ */
+#define REQUEST_PAIRS 32
+
+void benchIncremental() {
+    printf("Benchmark: Request latency, stop-the-world vs incremental vs"
+           " concurrent vs treadmill.\n");
+    Collector savedCollector = collector;
+    int savedGenerational = generational;
+    int savedIncremental = incrementalMark;
+    int savedConcurrent = concurrentMark;
+    SweepMode savedSweep = sweepMode;
+    int savedGcLog = gcLog;
+    const char* names[] = {"stop-the-world       ",
+                           "incremental          ",
+                           "incremental, lazy    ",
+                           "concurrent, lazy     ",
+                           "treadmill            "};
+    int requests = 200000;
+    double* latency = malloc(requests * sizeof(double));
+    if (latency == NULL) {
+        printf("Out of memory!\n");
+        exit(1);
+    }
+    gcLog = 0;
+
+    for (int c = 0; c < 5; c++) {
+        resetVM();
+        setGenerational(0);
+        collector = c == 4 ? COLLECTOR_TREADMILL : COLLECTOR_MARK_SWEEP;
+        incrementalMark = c > 0;
+        concurrentMark = c == 3;
+        sweepMode = c >= 2 ? SWEEP_LAZY : SWEEP_EAGER;
+        pushInt(0);
+        for (int i = 0; i < 500000; i++) {
+            pushInt(i);
+            pushPair();
+        }
+        gc();
+
+        long runs = fullCollections;
+        long steps = markSteps;
+        longestMarkStep = 0;
+        double longestPause = 0;
+        double start = nowSeconds();
+        for (int r = 0; r < requests; r++) {
+            double begin = nowSeconds();
+            for (int i = 0; i < REQUEST_PAIRS; i++) {
+                pushInt(i);
+                pushInt(r);
+                pushPair();
+                pop();
+            }
+            latency[r] = nowSeconds() - begin;
+            if (fullCollections != runs) {
+                runs = fullCollections;
+                if (lastGcPause > longestPause) longestPause = lastGcPause;
+            }
+        }
+        double seconds = nowSeconds() - start;
+
+        qsort(latency, requests, sizeof(double), compareDoubles);
+        printf(" %s: %6.3f s | p50 %6.2f us | p99 %7.2f us | max %8.2f us |"
+               " longest pause %6.2f ms, step %6.2f us (%ld steps)\n",
+               names[c], seconds, latency[requests / 2] * 1e6,
+               latency[requests - requests / 100] * 1e6,
+               latency[requests - 1] * 1e6, longestPause * 1e3,
+               longestMarkStep * 1e6, markSteps - steps);
+    }
+
+    free(latency);
+    resetVM();
+    collector = savedCollector;
+    incrementalMark = savedIncremental;
+    concurrentMark = savedConcurrent;
+    sweepMode = savedSweep;
+    gcLog = savedGcLog;
+    setGenerational(savedGenerational);
+}
+
+/**
+ * Minimum mutator utilization with a big live heap: stop-the-world vs
+ * incremental marking paced by allocation vs marking on the Metronome's
+ * time grid, at two MMU targets. The mutator is the same request loop as
+ * benchIncremental(). MMU is given for 1ms, 10ms and 100ms windows;
+ * "overruns" are marks the heap outgrew, which end in one long pause.
+ */
+void benchMetronome() {
+    printf("Benchmark: Minimum mutator utilization, by allocation vs by the"
+           " clock.\n");
+    int savedGenerational = generational;
+    int savedIncremental = incrementalMark;
+    int savedConcurrent = concurrentMark;
+    int savedTimeScheduled = timeScheduled;
+    double savedMmu = targetMmu;
+    SweepMode savedSweep = sweepMode;
+    int savedGcLog = gcLog;
+    const char* names[] = {"stop-the-world  ",
+                           "incremental     ",
+                           "metronome, 70%  ",
+                           "metronome, 50%  "};
+    double targets[] = {0, 0, 0.7, 0.5};
+    gcLog = 0;
+
+    for (int c = 0; c < 4; c++) {
+        resetVM();
+        setGenerational(0);
+        concurrentMark = 0;
+        incrementalMark = c > 0;
+        targetMmu = c >= 2 ? targets[c] : savedMmu;
+        setTimeScheduled(c >= 2);
+        sweepMode = c > 0 ? SWEEP_LAZY : SWEEP_EAGER;
+        pushInt(0);
+        for (int i = 0; i < 500000; i++) {
+            pushInt(i);
+            pushPair();
+        }
+        gc();
+
+        long overruns = markOverruns;
+        long runs = fullCollections;
+        recordGcTimes = 1;
+        numGcTimes = 0;
+        double start = nowSeconds();
+        for (int r = 0; r < 200000; r++) {
+            for (int i = 0; i < REQUEST_PAIRS; i++) {
+                pushInt(i);
+                pushInt(r);
+                pushPair();
+                pop();
+            }
+        }
+        double end = nowSeconds();
+        recordGcTimes = 0;
+
+        printf(" %s: %6.3f s | MMU 1ms %4.2f, 10ms %4.2f, 100ms %4.2f |"
+               " %ld cycles, %ld overruns\n",
+               names[c], end - start,
+               minimumMutatorUtilization(start, end, 1e-3),
+               minimumMutatorUtilization(start, end, 10e-3),
+               minimumMutatorUtilization(start, end, 100e-3),
+               fullCollections - runs, markOverruns - overruns);
+    }
+
+    numGcTimes = 0;
+    resetVM();
+    targetMmu = savedMmu;
+    setTimeScheduled(savedTimeScheduled);
+    incrementalMark = savedIncremental;
+    concurrentMark = savedConcurrent;
+    sweepMode = savedSweep;
+    gcLog = savedGcLog;
+    setGenerational(savedGenerational);
+}
+
+/**
+ * Heap growth policies: memory for throughput. A 100K-pair list stays
+ * alive while we churn through garbage pairs, under each policy in turn,
+ * and we count the collections and how many pages the heap ended up with.
+ */
+void benchGrowthPolicy() {
+    printf("Benchmark: Heap growth policies.\n");
+    int savedGenerational = generational;
+    GrowthPolicy savedPolicy = growthPolicy;
+    double savedFactor = growthFactor;
+    int savedGogc = gogcPercent;
+    double savedRatio = targetLiveRatio;
+    int savedCap = maxHeapObjects;
+    int savedGcLog = gcLog;
+    const char* names[] = {"factor 2       ", "gogc 50        ",
+                           "gogc 400       ", "live ratio 0.2 ",
+                           "max heap 300K  "};
+    GrowthPolicy policies[] = {GROWTH_FACTOR, GROWTH_GOGC, GROWTH_GOGC,
+                               GROWTH_LIVE_RATIO, GROWTH_MAX_HEAP};
+    int gogc[] = {100, 50, 400, 100, 100};
+    gcLog = 0;
+
+    for (int c = 0; c < 5; c++) {
+        resetVM();
+        setGenerational(0);
+        growthPolicy = policies[c];
+        growthFactor = 2;
+        gogcPercent = gogc[c];
+        targetLiveRatio = 0.2;
+        maxHeapObjects = 300000;
+        pushInt(0);
+        for (int i = 0; i < 100000; i++) {
+            pushInt(i);
+            pushPair();
+        }
+
+        long runs = fullCollections;
+        double start = nowSeconds();
+        for (int i = 0; i < 5000000; i++) {
+            pushInt(i);
+            pushInt(i);
+            pushPair();
+            pop();
+        }
+        double seconds = nowSeconds() - start;
+        printf(" %s: %6.3f s | %5ld GCs | %5d pages\n", names[c], seconds,
+               fullCollections - runs, numPages);
+    }
+
+    resetVM();
+    growthPolicy = savedPolicy;
+    growthFactor = savedFactor;
+    gogcPercent = savedGogc;
+    targetLiveRatio = savedRatio;
+    maxHeapObjects = savedCap;
+    gcLog = savedGcLog;
+    setGenerational(savedGenerational);
+}
+
+/**
+ * Runs every benchmark. These are too slow (and too noisy) to run with the
+ * normal tests, so they only run with "./main bench".
+ */
+void runBenchmarks() {
+    benchMarkPrefetch();
+    benchParallelMark();
+    benchParallelSweep();
+    benchDeadPageSweep();
+    benchMarkEpochFlip();
+    benchImmediateInts();
+    benchObjectLayout();
+    benchGenerational();
+    benchWriteBarrier();
+    benchCopying();
+    benchCompaction();
+    benchImmix();
+    benchIncremental();
+    benchMetronome();
+    benchGrowthPolicy();
+}